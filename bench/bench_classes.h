@@ -0,0 +1,349 @@
+#ifndef LROS_BENCH_CLASSES_H_
+#define LROS_BENCH_CLASSES_H_
+
+#include "lros.h"
+
+#include <atomic>
+
+//
+// sample classes of the benchmark suite
+//	- BenchSmall	: a few numeric fields, typical state object
+//	- BenchWide		: 32 numeric fields of mixed types
+//	- BenchString	: string heavy, short names and a longer text
+//	- BenchArray	: large numeric arrays, bulk encoded
+//	- BenchNode		: binary tree node, for nested LRef graphs
+//	- BenchPooled	: BenchSmall layout allocated from a slab pool
+//	- BenchService	: rpc service, small calls
+//	- BenchTracked	: counts live instances, shared between threads
+//	- same() compares the fields directly, so a broken codec cannot hide
+//	  behind a second pass through itself
+//
+
+class BenchSmall : public lros::LDerivedObject<BenchSmall>
+{
+public:
+	L_FIELD_STD(id, lros::lint32)
+	L_FIELD_STD(hp, lros::lint32)
+	L_FIELD_STD(speed, lros::lfloat)
+	L_FIELD_STD(alive, lros::lbool)
+
+	L_FIELD_LIST_BEGIN
+	L_REGISTER_FIELD(1, id)
+	L_REGISTER_FIELD(2, hp)
+	L_REGISTER_FIELD(3, speed)
+	L_REGISTER_FIELD(4, alive)
+	L_FIELD_LIST_END
+
+	void fill(int seed)
+	{
+		set_id(seed);
+		set_hp(100 + seed % 900);
+		set_speed(seed * 0.5f);
+		set_alive(seed % 2 == 0);
+	}
+	void touch(int seed) { set_hp(seed); }
+	bool same(const BenchSmall& o) const
+	{
+		return get_id() == o.get_id() && get_hp() == o.get_hp()
+			&& get_speed() == o.get_speed() && get_alive() == o.get_alive();
+	}
+};
+
+class BenchPooled : public lros::LDerivedObject<BenchPooled>
+{
+public:
+	L_FIELD_STD(id, lros::lint32)
+	L_FIELD_STD(hp, lros::lint32)
+	L_FIELD_STD(speed, lros::lfloat)
+	L_FIELD_STD(alive, lros::lbool)
+
+	L_FIELD_LIST_BEGIN
+	L_REGISTER_FIELD(1, id)
+	L_REGISTER_FIELD(2, hp)
+	L_REGISTER_FIELD(3, speed)
+	L_REGISTER_FIELD(4, alive)
+	L_FIELD_LIST_END
+};
+
+class BenchWide : public lros::LDerivedObject<BenchWide>
+{
+public:
+	typedef lros::lbool lbool;
+	typedef lros::lbyte lbyte;
+	typedef lros::lint16 lint16;
+	typedef lros::lint32 lint32;
+	typedef lros::lint64 lint64;
+	typedef lros::lfloat lfloat;
+	typedef lros::ldouble ldouble;
+
+	L_FIELD_STD(f00, lint32)
+	L_FIELD_STD(f01, lint64)
+	L_FIELD_STD(f02, lfloat)
+	L_FIELD_STD(f03, ldouble)
+	L_FIELD_STD(f04, lint16)
+	L_FIELD_STD(f05, lbyte)
+	L_FIELD_STD(f06, lbool)
+	L_FIELD_STD(f07, lint32)
+	L_FIELD_STD(f08, lint32)
+	L_FIELD_STD(f09, lint64)
+	L_FIELD_STD(f10, lfloat)
+	L_FIELD_STD(f11, ldouble)
+	L_FIELD_STD(f12, lint16)
+	L_FIELD_STD(f13, lbyte)
+	L_FIELD_STD(f14, lbool)
+	L_FIELD_STD(f15, lint32)
+	L_FIELD_STD(f16, lint32)
+	L_FIELD_STD(f17, lint64)
+	L_FIELD_STD(f18, lfloat)
+	L_FIELD_STD(f19, ldouble)
+	L_FIELD_STD(f20, lint16)
+	L_FIELD_STD(f21, lbyte)
+	L_FIELD_STD(f22, lbool)
+	L_FIELD_STD(f23, lint32)
+	L_FIELD_STD(f24, lint32)
+	L_FIELD_STD(f25, lint64)
+	L_FIELD_STD(f26, lfloat)
+	L_FIELD_STD(f27, ldouble)
+	L_FIELD_STD(f28, lint16)
+	L_FIELD_STD(f29, lbyte)
+	L_FIELD_STD(f30, lbool)
+	L_FIELD_STD(f31, lint32)
+
+	L_FIELD_LIST_BEGIN
+	L_REGISTER_FIELD(1, f00)
+	L_REGISTER_FIELD(2, f01)
+	L_REGISTER_FIELD(3, f02)
+	L_REGISTER_FIELD(4, f03)
+	L_REGISTER_FIELD(5, f04)
+	L_REGISTER_FIELD(6, f05)
+	L_REGISTER_FIELD(7, f06)
+	L_REGISTER_FIELD(8, f07)
+	L_REGISTER_FIELD(9, f08)
+	L_REGISTER_FIELD(10, f09)
+	L_REGISTER_FIELD(11, f10)
+	L_REGISTER_FIELD(12, f11)
+	L_REGISTER_FIELD(13, f12)
+	L_REGISTER_FIELD(14, f13)
+	L_REGISTER_FIELD(15, f14)
+	L_REGISTER_FIELD(16, f15)
+	L_REGISTER_FIELD(17, f16)
+	L_REGISTER_FIELD(18, f17)
+	L_REGISTER_FIELD(19, f18)
+	L_REGISTER_FIELD(20, f19)
+	L_REGISTER_FIELD(21, f20)
+	L_REGISTER_FIELD(22, f21)
+	L_REGISTER_FIELD(23, f22)
+	L_REGISTER_FIELD(24, f23)
+	L_REGISTER_FIELD(25, f24)
+	L_REGISTER_FIELD(26, f25)
+	L_REGISTER_FIELD(27, f26)
+	L_REGISTER_FIELD(28, f27)
+	L_REGISTER_FIELD(29, f28)
+	L_REGISTER_FIELD(30, f29)
+	L_REGISTER_FIELD(31, f30)
+	L_REGISTER_FIELD(32, f31)
+	L_FIELD_LIST_END
+
+	void fill(int seed)
+	{
+		set_f00((lint32)(seed * 7919 + 0));
+		set_f01((lint64)seed * 1000003 + 1);
+		set_f02(seed * 0.5f + 2);
+		set_f03(seed * 0.25 + 3);
+		set_f04((lint16)(seed + 4));
+		set_f05((lbyte)(seed + 5));
+		set_f06((seed + 6) % 2 == 0);
+		set_f07((lint32)(seed * 7919 + 7));
+		set_f08((lint32)(seed * 7919 + 8));
+		set_f09((lint64)seed * 1000003 + 9);
+		set_f10(seed * 0.5f + 10);
+		set_f11(seed * 0.25 + 11);
+		set_f12((lint16)(seed + 12));
+		set_f13((lbyte)(seed + 13));
+		set_f14((seed + 14) % 2 == 0);
+		set_f15((lint32)(seed * 7919 + 15));
+		set_f16((lint32)(seed * 7919 + 16));
+		set_f17((lint64)seed * 1000003 + 17);
+		set_f18(seed * 0.5f + 18);
+		set_f19(seed * 0.25 + 19);
+		set_f20((lint16)(seed + 20));
+		set_f21((lbyte)(seed + 21));
+		set_f22((seed + 22) % 2 == 0);
+		set_f23((lint32)(seed * 7919 + 23));
+		set_f24((lint32)(seed * 7919 + 24));
+		set_f25((lint64)seed * 1000003 + 25);
+		set_f26(seed * 0.5f + 26);
+		set_f27(seed * 0.25 + 27);
+		set_f28((lint16)(seed + 28));
+		set_f29((lbyte)(seed + 29));
+		set_f30((seed + 30) % 2 == 0);
+		set_f31((lint32)(seed * 7919 + 31));
+	}
+	void touch(int seed) { set_f00(seed); }
+	bool same(const BenchWide& o) const
+	{
+		return get_f00() == o.get_f00()
+			&& get_f01() == o.get_f01()
+			&& get_f02() == o.get_f02()
+			&& get_f03() == o.get_f03()
+			&& get_f04() == o.get_f04()
+			&& get_f05() == o.get_f05()
+			&& get_f06() == o.get_f06()
+			&& get_f07() == o.get_f07()
+			&& get_f08() == o.get_f08()
+			&& get_f09() == o.get_f09()
+			&& get_f10() == o.get_f10()
+			&& get_f11() == o.get_f11()
+			&& get_f12() == o.get_f12()
+			&& get_f13() == o.get_f13()
+			&& get_f14() == o.get_f14()
+			&& get_f15() == o.get_f15()
+			&& get_f16() == o.get_f16()
+			&& get_f17() == o.get_f17()
+			&& get_f18() == o.get_f18()
+			&& get_f19() == o.get_f19()
+			&& get_f20() == o.get_f20()
+			&& get_f21() == o.get_f21()
+			&& get_f22() == o.get_f22()
+			&& get_f23() == o.get_f23()
+			&& get_f24() == o.get_f24()
+			&& get_f25() == o.get_f25()
+			&& get_f26() == o.get_f26()
+			&& get_f27() == o.get_f27()
+			&& get_f28() == o.get_f28()
+			&& get_f29() == o.get_f29()
+			&& get_f30() == o.get_f30()
+			&& get_f31() == o.get_f31();
+	}
+};
+
+class BenchString : public lros::LDerivedObject<BenchString>
+{
+public:
+	L_FIELD_STD(name, lros::lstring)
+	L_FIELD_STD(title, lros::lstring)
+	L_FIELD_STD(guild, lros::lstring)
+	L_FIELD_STD(text, lros::lstring)
+
+	L_FIELD_LIST_BEGIN
+	L_REGISTER_FIELD(1, name)
+	L_REGISTER_FIELD(2, title)
+	L_REGISTER_FIELD(3, guild)
+	L_REGISTER_FIELD(4, text)
+	L_FIELD_LIST_END
+
+	void fill(int seed)
+	{
+		set_name("player_" + std::to_string(seed));
+		set_title("the brave");
+		set_guild("knights of the round table");
+		set_text(std::string(200, (char)('a' + seed % 26)));
+	}
+	void touch(int seed) { set_name("player_" + std::to_string(seed)); }
+	bool same(const BenchString& o) const
+	{
+		return get_name() == o.get_name() && get_title() == o.get_title()
+			&& get_guild() == o.get_guild() && get_text() == o.get_text();
+	}
+};
+
+class BenchArray : public lros::LDerivedObject<BenchArray>
+{
+public:
+	static const int kCount = 1024;
+
+	L_FIELD_ARRAY(values, lros::lint32)
+	L_FIELD_ARRAY(weights, lros::lfloat)
+
+	L_FIELD_LIST_BEGIN
+	L_REGISTER_FIELD(1, values)
+	L_REGISTER_FIELD(2, weights)
+	L_FIELD_LIST_END
+
+	void fill(int seed)
+	{
+		std::vector<lros::lint32> values(kCount);
+		std::vector<lros::lfloat> weights(kCount);
+		for (int i = 0; i < kCount; ++i)
+		{
+			values[i] = seed + i;
+			weights[i] = (seed + i) * 0.5f;
+		}
+		set_values(values);
+		set_weights(weights);
+	}
+	void touch(int seed) { set_values_at(seed % kCount, seed); }
+	bool same(const BenchArray& o) const
+	{
+		return get_values() == o.get_values() && get_weights() == o.get_weights();
+	}
+};
+
+class BenchNode : public lros::LDerivedObject<BenchNode>
+{
+public:
+	L_FIELD_STD(value, lros::lint32)
+	L_FIELD_REF(left, BenchNode)
+	L_FIELD_REF(right, BenchNode)
+
+	L_FIELD_LIST_BEGIN
+	L_REGISTER_FIELD(1, value)
+	L_REGISTER_FIELD(2, left)
+	L_REGISTER_FIELD(3, right)
+	L_FIELD_LIST_END
+};
+
+class BenchService : public lros::LDerivedObject<BenchService>
+{
+public:
+	BenchService() : moves(0) {}
+
+	L_FIELD_LIST_BEGIN
+	L_FIELD_LIST_END
+
+	lros::lint32 add(lros::lint32 a, lros::lint32 b) { return a + b; }
+	void move(lros::lint32 id, lros::lfloat x, lros::lfloat y) { moves += id + (int)(x + y); }
+
+	L_RPC_LIST_BEGIN
+	L_REGISTER_RPC(1, add)
+	L_REGISTER_RPC(2, move)
+	L_RPC_LIST_END
+
+	size_t moves;
+};
+
+class BenchTracked : public lros::LDerivedObject<BenchTracked>
+{
+public:
+	static const int kMaxThreads = 32;
+
+	BenchTracked()
+	{
+		for (int i = 0; i < kMaxThreads; ++i)
+			slots[i] = 0;
+		++live_count();
+	}
+	~BenchTracked()
+	{
+		size_t sum = 0;
+		for (int i = 0; i < kMaxThreads; ++i)
+			sum += slots[i];
+		last_sum_value() = sum;
+		--live_count();
+	}
+
+	L_FIELD_LIST_BEGIN
+	L_FIELD_LIST_END
+
+	static int live() { return live_count().load(); }
+	// sum of the slots of the last destroyed object
+	static size_t last_sum() { return last_sum_value().load(); }
+
+	size_t slots[kMaxThreads];	// one per thread, plain writes
+
+private:
+	static std::atomic<int>& live_count() { static std::atomic<int> n(0); return n; }
+	static std::atomic<size_t>& last_sum_value() { static std::atomic<size_t> n(0); return n; }
+};
+
+#endif //LROS_BENCH_CLASSES_H_
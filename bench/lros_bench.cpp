@@ -0,0 +1,1472 @@
+//
+// lros_bench - serialization, creation, reference and transport benchmarks
+//	- one JSON object per line on stdout:
+//	  {"name":..., "ns_per_op":..., "bytes_per_object":..., "objects_per_op":..., "iterations":...}
+//	- ns_per_op is the best of several runs
+//	- checks compare decoded data with its source first, a failed one is
+//	  reported on stderr and the run exits non-zero
+//	- usage: lros_bench [--quick] [--filter=<substring>] [--trace]
+//
+#include "bench_classes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace lros;
+
+LCLASS_IMPLEMENT(0x200, BenchSmall)
+LCLASS_IMPLEMENT_POOL(0x201, BenchPooled, 1024)
+LCLASS_IMPLEMENT(0x202, BenchWide)
+LCLASS_IMPLEMENT(0x203, BenchString)
+LCLASS_IMPLEMENT(0x204, BenchNode)
+LCLASS_IMPLEMENT(0x205, BenchArray)
+LCLASS_IMPLEMENT(0x206, BenchService)
+LCLASS_IMPLEMENT(0x207, BenchTracked)
+
+namespace
+{
+
+const int kRuns = 5;
+
+struct BenchOptions
+{
+	BenchOptions() : quick(false), trace(false) {}
+	bool quick;
+	bool trace;
+	std::string filter;
+};
+
+BenchOptions g_options;
+
+// keeps the optimizer from dropping benchmarked work
+volatile size_t g_sink = 0;
+
+struct BenchResult
+{
+	BenchResult() : bytes_per_object(0), objects_per_op(1) {}
+	double bytes_per_object;
+	double objects_per_op;
+};
+
+bool bench_selected(const std::string& name)
+{
+	return g_options.filter.empty() || name.find(g_options.filter) != std::string::npos;
+}
+
+// set by a failed check, the run exits non-zero
+bool g_failed = false;
+
+// checks run before the timed runs of a benchmark, also with --quick,
+// they compare decoded data with its source
+void bench_check(bool ok, const std::string& name, const char* what)
+{
+	if (ok)
+		return;
+	fprintf(stderr, "check failed: %s: %s\n", name.c_str(), what);
+	g_failed = true;
+}
+
+// the slave objects at ids equal objs, skipping objects with changes the
+// host did not send yet unless all
+template<typename T, typename S>
+bool slave_matches(const std::vector<LRef<T> >& objs, const std::vector<int>& ids, const S& slave, bool all)
+{
+	for (size_t i = 0; i < objs.size(); ++i)
+	{
+		if (!all && objs[i]->l_is_dirty())
+			continue;
+		LObject* obj = slave.find(ids[i]);
+		if (!obj || !obj->l_same_class(T::l_meta_class()) || !static_cast<T*>(obj)->same(*objs[i]))
+			return false;
+	}
+	return true;
+}
+
+// F runs iterations ops and returns what to report besides the time
+template<typename F>
+void bench_run(const std::string& name, size_t iterations, F f)
+{
+	if (!bench_selected(name))
+		return;
+	if (g_options.quick)
+		iterations = iterations / 100 + 1;
+
+	BenchResult result = f(iterations / 10 + 1);	// warm up
+	double best = 0;
+	for (int run = 0; run < kRuns; ++run)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		result = f(iterations);
+		double ns = std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - begin).count() / iterations;
+		if (run == 0 || ns < best)
+			best = ns;
+	}
+
+	printf("{\"name\":\"%s\", \"ns_per_op\":%.2f, \"bytes_per_object\":%.2f, "
+		"\"objects_per_op\":%.0f, \"iterations\":%zu}\n",
+		name.c_str(), best, result.bytes_per_object, result.objects_per_op, iterations);
+	fflush(stdout);
+}
+
+const char* format_name(LWireFormat format)
+{
+	return format == kWire_Compact ? "compact" : "fixed";
+}
+
+//////////////////////////////////////////////////////////////////////////
+// encode/decode of one object, through the class serializers
+template<typename T>
+void bench_codec(const char* class_name, LWireFormat format, size_t iterations)
+{
+	const LClass* cls = T::l_meta_class();
+	LRef<T> src(T::l_new());
+	src->fill(12345);
+	src->l_clear_dirty();
+
+	LMemStream encoded;
+	encoded.set_wire_format(format);
+	cls->serializer()(encoded, src.get());
+	const double bytes = (double)encoded.size();
+
+	std::string suffix = std::string(class_name) + "/" + format_name(format);
+	if (bench_selected("decode/" + suffix) || bench_selected("delta/" + suffix))
+	{
+		LRef<T> dst(T::l_new());
+		encoded.rewind();
+		bench_check(cls->deserializer()(encoded, dst.get()) && dst->same(*src),
+			"decode/" + suffix, "decoded object differs");
+
+		// a run of deltas applied to the decoded copy, the first one is no
+		// larger than the rest, it carries nothing the full encoding did
+		LMemStream m;
+		m.set_wire_format(format);
+		size_t first = 0, largest = 0;
+		for (int i = 0; i < 100; ++i)
+		{
+			m.reset();
+			src->touch(i * 7919 + 1);
+			cls->delta_serializer()(m, src.get());
+			cls->deserializer()(m, dst.get());
+			if (i == 0)
+				first = m.size();
+			else
+				largest = std::max(largest, m.size());
+		}
+		bench_check(dst->same(*src), "delta/" + suffix, "object after deltas differs");
+		bench_check(first <= largest, "delta/" + suffix, "first delta resends the full encoding");
+	}
+
+	bench_run("encode/" + suffix, iterations, [&](size_t n)
+	{
+		LMemStream m;
+		m.set_wire_format(format);
+		for (size_t i = 0; i < n; ++i)
+		{
+			m.reset();
+			cls->serializer()(m, src.get());
+		}
+		g_sink = m.size();
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		return r;
+	});
+
+	bench_run("decode/" + suffix, iterations, [&](size_t n)
+	{
+		LRef<T> dst(T::l_new());
+		for (size_t i = 0; i < n; ++i)
+		{
+			encoded.rewind();
+			cls->deserializer()(encoded, dst.get());
+		}
+		g_sink = encoded.read_pos();
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		return r;
+	});
+
+	// one field changed per op, the usual replication update
+	bench_run("delta/" + suffix, iterations, [&](size_t n)
+	{
+		LMemStream m;
+		m.set_wire_format(format);
+		size_t total = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			m.reset();
+			src->touch((int)i);
+			cls->delta_serializer()(m, src.get());
+			total += m.size();
+		}
+		BenchResult r;
+		r.bytes_per_object = (double)total / n;
+		return r;
+	});
+}
+
+//////////////////////////////////////////////////////////////////////////
+// encode of T through the field table against the std::function/std::bind
+// dispatch the table replaced, fields copied per object as it used to
+template<typename T>
+void bench_field_dispatch(const char* class_name, size_t iterations)
+{
+	typedef std::function<bool(LStream&, const T&)> Serializer;
+	struct OldField
+	{
+		int field_id;
+		Serializer serializer;
+	};
+	std::vector<OldField> old_fields;
+	for (const auto& f : T::__field_registry.field_list)
+	{
+		OldField field = { f.field_id, std::bind(f.serializer, std::placeholders::_1, std::placeholders::_2) };
+		old_fields.push_back(field);
+	}
+
+	LRef<T> src(T::l_new());
+	src->fill(12345);
+	const T& obj = *src;
+
+	bench_run(std::string("field_dispatch/") + class_name + "/table", iterations, [&](size_t n)
+	{
+		LMemStream m;
+		for (size_t i = 0; i < n; ++i)
+		{
+			m.reset();
+			T::l_serialize(m, &obj);
+		}
+		g_sink = m.size();
+		BenchResult r;
+		r.bytes_per_object = (double)m.size();
+		return r;
+	});
+
+	bench_run(std::string("field_dispatch/") + class_name + "/std_function", iterations, [&](size_t n)
+	{
+		LMemStream m;
+		for (size_t i = 0; i < n; ++i)
+		{
+			m.reset();
+			for (auto f : old_fields)
+			{
+				m.write_field_id(f.field_id);
+				f.serializer(m, obj);
+			}
+			m.write_field_id(-1);
+		}
+		g_sink = m.size();
+		BenchResult r;
+		r.bytes_per_object = (double)m.size();
+		return r;
+	});
+}
+
+//////////////////////////////////////////////////////////////////////////
+// walk the fields of an encoded BenchString, strings as views into the buffer
+void bench_string_view(LWireFormat format, size_t iterations)
+{
+	LRef<BenchString> src(BenchString::l_new());
+	src->fill(12345);
+
+	LMemStream encoded;
+	encoded.set_wire_format(format);
+	BenchString::l_serialize(encoded, src.get());
+	const double bytes = (double)encoded.size();
+
+	std::string name = std::string("decode_view/string/") + format_name(format);
+	if (bench_selected(name))
+	{
+		encoded.rewind();
+		std::vector<lstring> fields;
+		int field_id = -1;
+		LStringView v;
+		for (encoded.read_field_id(field_id); field_id != -1 && encoded.read(v); encoded.read_field_id(field_id))
+			fields.push_back(v.str());
+		bench_check(fields.size() == 4 && fields[0] == src->get_name() && fields[1] == src->get_title()
+			&& fields[2] == src->get_guild() && fields[3] == src->get_text(), name, "string views differ");
+	}
+
+	bench_run(name, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			encoded.rewind();
+			int field_id = -1;
+			LStringView v;
+			for (encoded.read_field_id(field_id); field_id != -1; encoded.read_field_id(field_id))
+			{
+				encoded.read(v);
+				g_sink += v.size();
+			}
+		}
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		return r;
+	});
+}
+
+//////////////////////////////////////////////////////////////////////////
+// n objects of one class, columnar LBatch against l_serialize per object
+template<typename T>
+void bench_batch(const char* class_name, LWireFormat format, size_t objects, size_t iterations)
+{
+	std::vector<LRef<T> > src;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<T> obj(T::l_new());
+		obj->fill((int)i);
+		src.push_back(obj);
+	}
+
+	LMemStream encoded;
+	encoded.set_wire_format(format);
+	LBatch<T>::write(encoded, src);
+	const double bytes = (double)encoded.size() / objects;
+
+	std::string suffix = std::string(class_name) + "/" + format_name(format);
+	if (bench_selected("batch_decode/" + suffix))
+	{
+		// into new objects, then into existing ones
+		std::vector<LRef<T> > dst;
+		encoded.rewind();
+		bool ok = LBatch<T>::read(encoded, dst) && dst.size() == src.size();
+		for (size_t i = 0; ok && i < dst.size(); ++i)
+			ok = dst[i]->same(*src[i]);
+		bench_check(ok, "batch_decode/" + suffix, "batch decoded objects differ");
+
+		std::vector<LRef<T> > fresh;
+		std::vector<T*> ptrs;
+		for (size_t i = 0; i < objects; ++i)
+		{
+			fresh.push_back(LRef<T>(T::l_new()));
+			ptrs.push_back(fresh.back().get());
+		}
+		encoded.rewind();
+		ok = LBatch<T>::read(encoded, ptrs.data(), ptrs.size());
+		for (size_t i = 0; ok && i < ptrs.size(); ++i)
+			ok = ptrs[i]->same(*src[i]);
+		bench_check(ok, "batch_decode/" + suffix, "batch decoded into existing objects differs");
+	}
+
+	bench_run("batch_encode/" + suffix, iterations, [&](size_t n)
+	{
+		LMemStream m;
+		m.set_wire_format(format);
+		for (size_t i = 0; i < n; ++i)
+		{
+			m.reset();
+			LBatch<T>::write(m, src);
+		}
+		g_sink = m.size();
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		r.objects_per_op = (double)objects;
+		return r;
+	});
+
+	bench_run("batch_decode/" + suffix, iterations, [&](size_t n)
+	{
+		std::vector<LRef<T> > dst;
+		encoded.rewind();
+		LBatch<T>::read(encoded, dst);
+		std::vector<T*> ptrs;
+		for (const auto& obj : dst)
+			ptrs.push_back(obj.get());
+		for (size_t i = 0; i < n; ++i)
+		{
+			encoded.rewind();
+			LBatch<T>::read(encoded, ptrs.data(), ptrs.size());
+		}
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		r.objects_per_op = (double)objects;
+		return r;
+	});
+
+	bench_run("batch_baseline_encode/" + suffix, iterations, [&](size_t n)
+	{
+		LMemStream m;
+		m.set_wire_format(format);
+		for (size_t i = 0; i < n; ++i)
+		{
+			m.reset();
+			for (const auto& obj : src)
+				T::l_serialize(m, obj.get());
+		}
+		BenchResult r;
+		r.bytes_per_object = (double)m.size() / objects;
+		r.objects_per_op = (double)objects;
+		return r;
+	});
+}
+
+//////////////////////////////////////////////////////////////////////////
+// object creation through l_new, including the field initializers
+template<typename T>
+void bench_create(const char* class_name, size_t iterations)
+{
+	bench_run(std::string("create/") + class_name, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			T* obj = T::l_new();
+			g_sink += (size_t)obj->l_ref_id();
+			delete obj;
+		}
+		return BenchResult();
+	});
+
+	// allocate in batches so the allocator cannot recycle the same block
+	bench_run(std::string("create_batch/") + class_name, iterations, [&](size_t n)
+	{
+		const size_t kBatch = 256;
+		std::vector<T*> objects;
+		objects.reserve(kBatch);
+		for (size_t done = 0; done < n; done += kBatch)
+		{
+			size_t count = n - done < kBatch ? n - done : kBatch;
+			for (size_t i = 0; i < count; ++i)
+				objects.push_back(T::l_new());
+			for (T* obj : objects)
+				delete obj;
+			objects.clear();
+		}
+		return BenchResult();
+	});
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ref copy + release, count policy P
+template<typename P>
+void bench_ref(const char* policy_name, size_t iterations)
+{
+	bench_run(std::string("ref_copy_release/") + policy_name, iterations, [&](size_t n)
+	{
+		LRef<BenchSmall, P> src = make_ref<BenchSmall, P>();
+		for (size_t i = 0; i < n; ++i)
+		{
+			LRef<BenchSmall, P> copy(src);
+			g_sink += (size_t)copy.get();
+		}
+		return BenchResult();
+	});
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LSharedRef copy + release from threads at once
+//	- every thread writes its own slot of the object between copies,
+//	  the destructor sums the slots wherever the last release runs
+//	- the sum is only complete when every release publishes the writes
+//	  before it and the last one acquires them
+void bench_shared_ref_threads(size_t threads, size_t iterations)
+{
+	std::string name = "ref_shared_threads/t" + std::to_string(threads);
+	bool ok = true;
+	bench_run(name, iterations, [&](size_t n)
+	{
+		size_t per_thread = n / threads + 1;
+		int live = BenchTracked::live();
+		std::atomic<size_t> started(0), finished(0);
+		std::atomic<bool> released(false);
+		LSharedRef<BenchTracked> src = make_ref<BenchTracked, LRefCountAtomic>();
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; ++t)
+		{
+			workers.push_back(std::thread([&, t]()
+			{
+				LSharedRef<BenchTracked> own(src);
+				++started;
+				while (started.load() < threads)
+					std::this_thread::yield();
+				for (size_t i = 0; i < per_thread; ++i)
+				{
+					LSharedRef<BenchTracked> copy(own);
+					++copy->slots[t];
+				}
+				++finished;
+				while (!released.load())
+					std::this_thread::yield();
+			}));
+		}
+		while (finished.load() < threads)
+			std::this_thread::yield();
+		// all copies but one per thread are gone
+		ok = ok && src.ref_count() == (int)threads + 1;
+		src.reset();
+		released = true;
+		for (std::thread& worker : workers)
+			worker.join();
+		ok = ok && BenchTracked::live() == live
+			&& BenchTracked::last_sum() == per_thread * threads;
+		return BenchResult();
+	});
+	if (bench_selected(name))
+		bench_check(ok, name, "shared object count or destruction wrong");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// nested LRef graphs
+//	- tree	: complete binary tree, every node referenced once
+//	- shared: chain where left and right point to the same node,
+//			  exercises back references of the ref cache
+LRef<BenchNode> make_tree(int depth, int& count)
+{
+	LRef<BenchNode> node(BenchNode::l_new());
+	node->set_value(count++);
+	if (depth > 1)
+	{
+		node->set_left(make_tree(depth - 1, count));
+		node->set_right(make_tree(depth - 1, count));
+	}
+	return node;
+}
+
+LRef<BenchNode> make_shared_chain(int depth, int& count)
+{
+	LRef<BenchNode> node(BenchNode::l_new());
+	node->set_value(count++);
+	if (depth > 1)
+	{
+		LRef<BenchNode> child = make_shared_chain(depth - 1, count);
+		node->set_left(child);
+		node->set_right(child);
+	}
+	return node;
+}
+
+// same values and the same sharing, a node of a maps to one node of b
+bool same_graph(BenchNode* a, BenchNode* b, std::map<BenchNode*, BenchNode*>& a_to_b,
+	std::map<BenchNode*, BenchNode*>& b_to_a)
+{
+	if (!a || !b)
+		return a == b;
+	auto ait = a_to_b.find(a);
+	auto bit = b_to_a.find(b);
+	if (ait != a_to_b.end() || bit != b_to_a.end())
+		return ait != a_to_b.end() && bit != b_to_a.end() && ait->second == b && bit->second == a;
+	a_to_b[a] = b;
+	b_to_a[b] = a;
+	return a->get_value() == b->get_value()
+		&& same_graph(a->get_left().get(), b->get_left().get(), a_to_b, b_to_a)
+		&& same_graph(a->get_right().get(), b->get_right().get(), a_to_b, b_to_a);
+}
+
+void bench_graph(const char* graph_name, const LRef<BenchNode>& root, int objects,
+	LWireFormat format, size_t iterations)
+{
+	LMemStream encoded;
+	encoded.set_wire_format(format);
+	encoded.write(root);
+	const double bytes = (double)encoded.size() / objects;
+
+	std::string suffix = std::string(graph_name) + "/" + format_name(format);
+	if (bench_selected("graph_decode/" + suffix))
+	{
+		encoded.rewind();
+		LRef<BenchNode> copy;
+		std::map<BenchNode*, BenchNode*> a_to_b, b_to_a;
+		bench_check(encoded.read(copy) && same_graph(root.get(), copy.get(), a_to_b, b_to_a)
+			&& a_to_b.size() == (size_t)objects, "graph_decode/" + suffix, "decoded graph differs");
+		encoded.ref_cache().clear();
+	}
+
+	bench_run("graph_encode/" + suffix, iterations, [&](size_t n)
+	{
+		LMemStream m;
+		m.set_wire_format(format);
+		for (size_t i = 0; i < n; ++i)
+		{
+			m.reset();
+			m.ref_cache().clear_written();
+			m.write(root);
+		}
+		g_sink = m.size();
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		r.objects_per_op = objects;
+		return r;
+	});
+
+	// every op materializes a new graph and destroys it
+	bench_run("graph_decode/" + suffix, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			encoded.rewind();
+			LRef<BenchNode> copy;
+			encoded.read(copy);
+			g_sink += (size_t)copy->get_value();
+			encoded.ref_cache().clear();
+		}
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		r.objects_per_op = objects;
+		return r;
+	});
+}
+
+#ifndef _WIN32
+//////////////////////////////////////////////////////////////////////////
+// snapshot of small objects, open does not depend on the object count,
+// get materializes one object
+void bench_snapshot(size_t objects)
+{
+	const char* path = "lros_bench.snap";
+	if (g_options.quick)
+		objects = objects / 100 + 1;
+
+	std::vector<int> ref_ids;
+	std::vector<LRef<BenchSmall> > src;
+	{
+		LSnapshotWriter writer;
+		for (size_t i = 0; i < objects; ++i)
+		{
+			LRef<BenchSmall> obj(BenchSmall::l_new());
+			obj->fill((int)i);
+			writer.add_root(obj);
+			ref_ids.push_back(obj.ref_id());
+			src.push_back(obj);
+		}
+		if (!writer.write(path))
+		{
+			fprintf(stderr, "failed to write %s\n", path);
+			return;
+		}
+	}
+
+	std::string suffix = std::to_string(objects);
+	if (bench_selected("snapshot_get/" + suffix))
+	{
+		LSnapshot snapshot;
+		bool ok = snapshot.open(path) && snapshot.object_count() == objects;
+		for (size_t i = 0; ok && i < objects; ++i)
+		{
+			LRef<BenchSmall> obj = snapshot.get<BenchSmall>(ref_ids[i]);
+			ok = obj.get() && obj->same(*src[i]);
+		}
+		bench_check(ok, "snapshot_get/" + suffix, "snapshot object differs");
+	}
+	bench_run("snapshot_open/" + suffix, 1000, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			LSnapshot snapshot;
+			snapshot.open(path);
+			g_sink += snapshot.object_count();
+		}
+		return BenchResult();
+	});
+
+	bench_run("snapshot_get/" + suffix, objects * 2, [&](size_t n)
+	{
+		LSnapshot snapshot;
+		snapshot.open(path);
+		for (size_t i = 0; i < n; ++i)
+		{
+			// every object once, in a scattered order
+			int ref_id = ref_ids[(i * 7919) % ref_ids.size()];
+			g_sink += (size_t)snapshot.get<BenchSmall>(ref_id)->get_hp();
+			if (snapshot.loaded_count() == ref_ids.size())
+				snapshot.open(path);
+		}
+		return BenchResult();
+	});
+
+	remove(path);
+}
+
+// write and load_all of a whole snapshot, threads 1 is the sequential path
+void bench_snapshot_parallel(size_t objects)
+{
+	const char* path = "lros_bench_parallel.snap";
+	if (g_options.quick)
+		objects = objects / 100 + 1;
+
+	std::vector<LRef<BenchWide> > roots;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<BenchWide> obj(BenchWide::l_new());
+		obj->fill((int)i);
+		roots.push_back(obj);
+	}
+	{
+		// load_all reads this one, also when the write benchmark is filtered out
+		LSnapshotWriter writer;
+		for (const auto& obj : roots)
+			writer.add_root(obj);
+		if (!writer.write(path))
+		{
+			fprintf(stderr, "failed to write %s\n", path);
+			return;
+		}
+	}
+
+	size_t max_threads = std::thread::hardware_concurrency();
+	std::string suffix = std::to_string(objects);
+	for (size_t threads = 1; threads <= 32; threads *= 2)
+	{
+		if (threads > 1 && threads > max_threads)
+			break;
+		LWorkPool pool(threads);
+		std::string name = suffix + "/t" + std::to_string(threads);
+
+		bench_run("snapshot_write/" + name, 10, [&](size_t n)
+		{
+			BenchResult r;
+			for (size_t i = 0; i < n; ++i)
+			{
+				LSnapshotWriter writer;
+				for (const auto& obj : roots)
+					writer.add_root(obj);
+				writer.write(path, &pool);
+			}
+			r.objects_per_op = (double)objects;
+			return r;
+		});
+
+		bench_run("snapshot_load_all/" + name, 10, [&](size_t n)
+		{
+			BenchResult r;
+			for (size_t i = 0; i < n; ++i)
+			{
+				LSnapshot snapshot;
+				snapshot.open(path);
+				snapshot.load_all(&pool);
+				g_sink += snapshot.loaded_count();
+			}
+			r.objects_per_op = (double)objects;
+			return r;
+		});
+
+		// the file of the last parallel write, loaded in parallel
+		if (bench_selected("snapshot_write/" + name) || bench_selected("snapshot_load_all/" + name))
+		{
+			LSnapshot snapshot;
+			bool ok = snapshot.open(path) && snapshot.load_all(&pool) && snapshot.loaded_count() == objects;
+			for (size_t i = 0; ok && i < objects; ++i)
+			{
+				LRef<BenchWide> obj = snapshot.get<BenchWide>(roots[i].ref_id());
+				ok = obj.get() && obj->same(*roots[i]);
+			}
+			bench_check(ok, "snapshot_load_all/" + name, "loaded object differs");
+		}
+	}
+
+	remove(path);
+}
+#endif
+
+// the slave matches the host after every flush, deferred objects aside,
+// and all of it once the budget is lifted
+void check_replica_flush(const std::string& name, size_t objects, size_t budget)
+{
+	LReplicaHost host;
+	host.set_budget(budget);
+	LReplicaSlave slave;
+	std::vector<LRef<BenchSmall> > objs;
+	std::vector<int> ids;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<BenchSmall> obj(BenchSmall::l_new());
+		obj->fill((int)i);
+		ids.push_back(host.add_object(obj.get()));
+		objs.push_back(obj);
+	}
+
+	LMemStream packet;
+	bool ok = true, fits = true;
+	for (int tick = 0; ok && tick < 20; ++tick)
+	{
+		for (size_t k = 0; k < objs.size(); ++k)
+			objs[k]->touch((int)(tick * 31 + k));
+		packet.reset();
+		size_t ops = host.flush(packet);
+		// only an object larger than the budget may overshoot, and it goes alone
+		if (budget > 0 && ops > 1 && packet.size() > budget)
+			fits = false;
+		ok = slave.apply(packet) && slave_matches(objs, ids, slave, false);
+	}
+	host.set_budget(0);
+	packet.reset();
+	host.flush(packet);
+	ok = ok && slave.apply(packet) && slave_matches(objs, ids, slave, true);
+	bench_check(ok, name, "slave differs from host");
+	bench_check(fits, name, "packet larger than the budget");
+	bench_check(host.deferred_count() == 0, name, "deferred count kept after the budget was dropped");
+}
+
+// kRep_Order packets delivered in a shuffled order, creates included,
+// the slave sequences them back
+void check_replica_order(size_t objects, size_t ticks)
+{
+	std::string name = "replica_order/" + std::to_string(objects);
+	if (!bench_selected(name))
+		return;
+
+	LReplicaHost host;
+	std::vector<LRef<BenchSmall> > objs;
+	std::vector<int> ids;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<BenchSmall> obj(BenchSmall::l_new());
+		obj->fill((int)i);
+		ids.push_back(host.add_object(obj.get(), kRep_Order));
+		objs.push_back(obj);
+	}
+
+	std::vector<std::vector<lbyte> > packets;
+	LMemStream packet;
+	for (size_t tick = 0; tick < ticks; ++tick)
+	{
+		for (size_t k = tick % 3; k < objs.size(); k += 3)
+			objs[k]->touch((int)(tick * 31 + k));
+		packet.reset();
+		host.flush(packet);
+		packets.push_back(std::vector<lbyte>(packet.data(), packet.data() + packet.size()));
+	}
+	std::mt19937 rng(12345);
+	std::shuffle(packets.begin(), packets.end(), rng);
+
+	LReplicaSlave slave;
+	bool ok = true;
+	for (size_t i = 0; ok && i < packets.size(); ++i)
+	{
+		packet.assign(packets[i].data(), packets[i].size());
+		ok = slave.apply(packet);
+	}
+	bench_check(ok && slave_matches(objs, ids, slave, true), name, "slave differs from host");
+}
+
+// every object changes each tick, more than the budget allows,
+// a budget of 0 sends all of them
+void bench_replica_budget(size_t objects, size_t budget, size_t iterations)
+{
+	std::string name = budget ? "replica_budget/" + std::to_string(objects) + "/" + std::to_string(budget)
+		: "replica_flush/" + std::to_string(objects);
+	if (bench_selected(name))
+		check_replica_flush(name, objects / 10, budget / 10);
+
+	LReplicaHost host;
+	host.set_budget(budget);
+	std::vector<LRef<BenchSmall> > objs;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<BenchSmall> obj(BenchSmall::l_new());
+		obj->fill((int)i);
+		host.add_object(obj.get());
+		objs.push_back(obj);
+	}
+
+	LMemStream packet;
+	size_t tick = 0;
+	double bytes = 0, sent = 0;
+	bench_run(name, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i, ++tick)
+		{
+			for (size_t k = 0; k < objs.size(); ++k)
+				objs[k]->touch((int)(tick + k));
+			packet.reset();
+			sent = (double)host.flush(packet);
+			bytes = (double)packet.size();
+		}
+		g_sink += host.max_wait();
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		r.objects_per_op = sent;
+		return r;
+	});
+}
+
+// a tenth of the objects change a little each tick, the rest is static,
+// the delta replica against the baseline of one slave that drops every
+// loss-th packet, loss 0 drops none
+void bench_baseline_change(std::vector<LRef<BenchSmall> >& objs, size_t tick)
+{
+	for (size_t k = 0; k < objs.size(); k += 10)
+	{
+		objs[k]->set_hp(objs[k]->get_hp() + (tick % 2 ? 1 : -1));
+		objs[k]->set_speed((float)(k + tick % 4) * 0.25f);
+	}
+}
+
+// the slave matches the host after every packet it gets, when the host
+// resends what the lost ones carried
+void check_replica_baseline(const std::string& name, size_t objects, size_t loss)
+{
+	LBaselineHost host;
+	LBaselineSlave slave;
+	int slave_id = host.add_slave();
+	std::vector<LRef<BenchSmall> > objs;
+	std::vector<int> ids;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<BenchSmall> obj(BenchSmall::l_new());
+		obj->fill((int)i);
+		ids.push_back(host.add_object(obj.get()));
+		objs.push_back(obj);
+	}
+
+	LMemStream packet;
+	packet.set_wire_format(kWire_Compact);
+	bool ok = true;
+	size_t applied = 0;
+	for (size_t tick = 1; ok && tick <= 200; ++tick)
+	{
+		bench_baseline_change(objs, tick);
+		host.capture();
+		packet.reset();
+		host.write(slave_id, packet);
+		if (loss && tick % loss == 0)
+			continue;
+		ok = slave.apply(packet) && slave_matches(objs, ids, slave, true);
+		host.ack(slave_id, slave.last_seq());
+		++applied;
+	}
+	bench_check(ok && applied > 0, name, "slave differs from host");
+}
+
+void bench_replica_baseline(size_t objects, size_t loss, size_t iterations)
+{
+	std::string name = "replica_baseline/" + std::to_string(objects);
+	if (loss)
+		name += "/loss" + std::to_string(loss);
+	if (bench_selected(name))
+		check_replica_baseline(name, objects / 10, loss);
+
+	LReplicaHost replica;
+	LBaselineHost host;
+	LBaselineSlave slave;
+	int slave_id = host.add_slave();
+	std::vector<LRef<BenchSmall> > objs;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<BenchSmall> obj(BenchSmall::l_new());
+		obj->fill((int)i);
+		replica.add_object(obj.get());
+		host.add_object(obj.get());
+		objs.push_back(obj);
+	}
+
+	// compact, field ids and obj_ids are most of a small delta
+	LMemStream packet;
+	packet.set_wire_format(kWire_Compact);
+	size_t tick = 0;
+	double bytes = 0, sent = 0;
+	if (loss == 0)
+	{
+		bench_run("replica_delta/" + std::to_string(objects), iterations, [&](size_t n)
+		{
+			for (size_t i = 0; i < n; ++i, ++tick)
+			{
+				bench_baseline_change(objs, tick);
+				packet.reset();
+				sent = (double)replica.flush(packet);
+				bytes = (double)packet.size();
+			}
+			BenchResult r;
+			r.bytes_per_object = bytes;
+			r.objects_per_op = sent;
+			return r;
+		});
+	}
+
+	bench_run(name, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i, ++tick)
+		{
+			bench_baseline_change(objs, tick);
+			sent = (double)host.capture();
+			packet.reset();
+			host.write(slave_id, packet);
+			bytes = (double)packet.size();
+			if (loss && tick % loss == 0)
+				continue;
+			slave.apply(packet);
+			host.ack(slave_id, slave.last_seq());
+		}
+		g_sink += slave.object_count();
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		r.objects_per_op = sent;
+		return r;
+	});
+}
+
+#ifdef __linux__
+// both ends of the connections live in one loop, server streams echo
+// or count what they receive, client streams apply replication packets
+struct BenchTcpHandler : public LTcpHandler
+{
+	BenchTcpHandler() : echo(false), received(0), replies(0) {}
+
+	virtual void on_open(LTcpStream& s)
+	{
+		if (!is_client(&s))
+			servers.push_back(&s);
+	}
+
+	virtual void on_frame(LTcpStream& s)
+	{
+		if (!is_client(&s))
+		{
+			++received;
+			if (!echo)
+				return;
+			payload.resize(s.frame_size());
+			s.read_bytes(payload.data(), payload.size());
+			s.write_bytes(payload.data(), payload.size());
+			s.end_frame();
+			return;
+		}
+		++replies;
+		auto it = slaves.find(&s);
+		if (it != slaves.end())
+			it->second->apply(s);
+	}
+
+	bool is_client(LTcpStream* s) const
+	{
+		return std::find(clients.begin(), clients.end(), s) != clients.end();
+	}
+
+	bool echo;
+	size_t received;
+	size_t replies;
+	std::vector<LTcpStream*> clients;
+	std::vector<LTcpStream*> servers;
+	std::map<LTcpStream*, LReplicaSlave*> slaves;
+	std::vector<lbyte> payload;
+};
+
+// connect count clients to the loop, false if loopback is not available
+bool bench_tcp_connect(LTcpLoop& loop, BenchTcpHandler& handler, size_t count)
+{
+	if (!loop.listen("127.0.0.1", 0))
+		return false;
+	for (size_t i = 0; i < count; ++i)
+	{
+		LTcpStream* s = loop.connect("127.0.0.1", loop.port());
+		if (!s)
+			return false;
+		handler.clients.push_back(s);
+	}
+	for (int i = 0; i < 1000 && handler.servers.size() < count; ++i)
+		loop.poll(10);
+	return handler.servers.size() == count;
+}
+
+void bench_tcp(size_t payload_size, size_t iterations)
+{
+	BenchTcpHandler handler;
+	LTcpLoop loop(&handler);
+	if (!bench_tcp_connect(loop, handler, 1))
+	{
+		fprintf(stderr, "loopback tcp not available\n");
+		return;
+	}
+	LTcpStream& client = *handler.clients[0];
+	std::vector<lbyte> payload(payload_size, 'x');
+	std::string suffix = std::to_string(payload_size);
+
+	// bursts of frames, each burst leaves in one send
+	bench_run("tcp_throughput/" + suffix, iterations, [&](size_t n)
+	{
+		static const size_t kBurst = 256;
+		handler.echo = false;
+		size_t target = handler.received + n;
+		for (size_t i = 0; i < n; i += kBurst)
+		{
+			for (size_t k = i; k < n && k < i + kBurst; ++k)
+			{
+				client.write_bytes(payload.data(), payload.size());
+				client.end_frame();
+			}
+			size_t sent = handler.received + (n - i < kBurst ? n - i : kBurst);
+			while (handler.received < sent && loop.poll(100) >= 0)
+			{
+			}
+		}
+		g_sink += target;
+		BenchResult r;
+		r.bytes_per_object = (double)(payload_size + LTcpStream::kHeaderSize);
+		return r;
+	});
+
+	bench_run("tcp_pingpong/" + suffix, iterations / 20, [&](size_t n)
+	{
+		handler.echo = true;
+		for (size_t i = 0; i < n; ++i)
+		{
+			size_t target = handler.replies + 1;
+			client.write_bytes(payload.data(), payload.size());
+			client.end_frame();
+			while (handler.replies < target && loop.poll(100) >= 0)
+			{
+			}
+		}
+		BenchResult r;
+		r.bytes_per_object = (double)(payload_size + LTcpStream::kHeaderSize);
+		return r;
+	});
+}
+
+// one host thread replicating to slaves, the packet is encoded once per tick
+// and shared by the output queues of all slaves
+void bench_tcp_fanout(size_t slave_count, size_t objects, size_t iterations)
+{
+	BenchTcpHandler handler;
+	LTcpLoop loop(&handler);
+	if (!bench_tcp_connect(loop, handler, slave_count))
+	{
+		fprintf(stderr, "loopback tcp not available\n");
+		return;
+	}
+	std::vector<std::unique_ptr<LReplicaSlave> > slaves;
+	for (LTcpStream* s : handler.clients)
+	{
+		slaves.push_back(std::unique_ptr<LReplicaSlave>(new LReplicaSlave()));
+		handler.slaves[s] = slaves.back().get();
+	}
+
+	LReplicaHost host;
+	std::vector<LRef<BenchSmall> > objs;
+	std::vector<int> ids;
+	for (size_t i = 0; i < objects; ++i)
+	{
+		LRef<BenchSmall> obj(BenchSmall::l_new());
+		obj->fill((int)i);
+		ids.push_back(host.add_object(obj.get()));
+		objs.push_back(obj);
+	}
+
+	size_t tick = 0;
+	double bytes = 0;
+	std::string name = "tcp_fanout/" + std::to_string(slave_count) + "/" + std::to_string(objects);
+	bench_run(name, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i, ++tick)
+		{
+			// a tenth of the objects change per tick
+			for (size_t k = tick % 10; k < objs.size(); k += 10)
+				objs[k]->touch((int)tick);
+			LSegmentRef packet = host.flush_segment();
+			bytes = (double)packet.size();
+
+			size_t target = handler.replies + handler.servers.size();
+			for (LTcpStream* s : handler.servers)
+			{
+				s->write_segment(packet);
+				s->end_frame();
+			}
+			while (handler.replies < target && loop.poll(100) >= 0)
+			{
+			}
+		}
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		r.objects_per_op = (double)slave_count;
+		return r;
+	});
+
+	// every tick waited for all slaves
+	if (bench_selected(name))
+	{
+		bool ok = true;
+		for (const auto& slave : slaves)
+			ok = ok && slave_matches(objs, ids, *slave, true);
+		bench_check(ok, name, "slave differs from host");
+	}
+}
+
+// server streams run rpc packets, client streams complete the futures
+struct BenchRpcHandler : public BenchTcpHandler
+{
+	BenchRpcHandler() : server(NULL), client(NULL) {}
+
+	virtual void on_frame(LTcpStream& s)
+	{
+		if (is_client(&s))
+		{
+			client->dispatch(s);
+			return;
+		}
+		server->dispatch(s, s);
+		s.end_frame();
+	}
+
+	LRpcServer* server;
+	LRpcClient* client;
+};
+
+void bench_rpc(size_t calls_per_tick, size_t iterations)
+{
+	BenchRpcHandler handler;
+	LTcpLoop loop(&handler);
+	if (!bench_tcp_connect(loop, handler, 1))
+	{
+		fprintf(stderr, "loopback tcp not available\n");
+		return;
+	}
+	BenchService service;
+	LRpcServer server;
+	server.add_service(&service);
+	LRpcClient client;
+	handler.server = &server;
+	handler.client = &client;
+	LTcpStream& stream = *handler.clients[0];
+
+	std::string name = "rpc_pipelined/" + std::to_string(calls_per_tick);
+	if (bench_selected(name))
+	{
+		std::vector<LRpcFuture<lint32> > sums;
+		for (lint32 k = 0; k < (lint32)calls_per_tick; ++k)
+			sums.push_back(client.call<L_RPC(BenchService, add)>(k, 1000 * k));
+		size_t moves = service.moves;
+		auto moved = client.call<L_RPC(BenchService, move)>(3, 1.0f, 2.0f);
+		client.flush(stream);
+		stream.end_frame();
+		while (client.pending_count() > 0 && loop.poll(100) >= 0)
+		{
+		}
+		bool ok = moved.ok() && service.moves == moves + 6;
+		for (lint32 k = 0; ok && k < (lint32)sums.size(); ++k)
+			ok = sums[k].ok() && sums[k].get() == k + 1000 * k;
+		bench_check(ok, name, "rpc results differ");
+	}
+
+	// calls_per_tick calls leave in one frame, the replies come back in one
+	size_t done = 0;
+	double bytes = 0;
+	bench_run(name, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; i += calls_per_tick)
+		{
+			size_t count = n - i < calls_per_tick ? n - i : calls_per_tick;
+			for (size_t k = 0; k < count; ++k)
+			{
+				if (k % 2)
+					client.call<L_RPC(BenchService, move)>((lint32)k, 1.0f, 2.0f);
+				else
+					client.call<L_RPC(BenchService, add)>((lint32)i, (lint32)k).then(
+						[&done](const LRpcFuture<lint32>& r) { done += r.get(); });
+			}
+			size_t before = stream.bytes_written();
+			client.flush(stream);
+			bytes = (double)(stream.bytes_written() - before) / count;
+			stream.end_frame();
+			while (client.pending_count() > 0 && loop.poll(100) >= 0)
+			{
+			}
+		}
+		g_sink += done;
+		BenchResult r;
+		r.bytes_per_object = bytes;
+		return r;
+	});
+}
+
+// child process of bench_shm, counts data frames, answers pings and flushes
+void bench_shm_child(const std::string& down_name, const std::string& up_name)
+{
+	LShmStream in, out;
+	if (!out.create(up_name.c_str(), 1 << 16) || !in.open(down_name.c_str()))
+		_exit(1);
+	while (true)
+	{
+		if (!in.next_frame())
+		{
+			in.wait(1000);
+			continue;
+		}
+		lbyte cmd = 0;
+		in.read(cmd);
+		if (cmd == 'q')
+			break;
+		if (cmd == 'd')
+			continue;
+		out.write(cmd);
+		out.end_frame();
+	}
+	// unlinks up_name, the parent keeps its mapping of the ring
+	out.close();
+	_exit(0);
+}
+
+// a host and a slave process on one box, one ring each way
+void bench_shm(size_t payload_size, size_t iterations)
+{
+	static int s_run = 0;
+	std::string suffix = std::to_string(payload_size);
+	std::string id = std::to_string(getpid()) + "_" + std::to_string(s_run++);
+	std::string down_name = "/lros_bench_down_" + id;
+	std::string up_name = "/lros_bench_up_" + id;
+	LShmStream down, up;
+	if (!down.create(down_name.c_str()))
+	{
+		fprintf(stderr, "shared memory not available\n");
+		return;
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0)
+		bench_shm_child(down_name, up_name);
+	for (int i = 0; i < 1000 && !up.open(up_name.c_str()); ++i)
+		usleep(1000);
+	if (!up.is_open())
+	{
+		fprintf(stderr, "shm child did not start\n");
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return;
+	}
+
+	std::vector<lbyte> payload(payload_size, 'x');
+	auto send = [&](lbyte cmd)
+	{
+		down.write(cmd);
+		down.write_bytes(payload.data(), payload.size());
+		down.end_frame();
+	};
+	auto reply = [&]()
+	{
+		while (!up.next_frame())
+			up.wait(1000);
+	};
+
+	bench_run("shm_throughput/" + suffix, iterations, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			send('d');
+		send('f');
+		reply();
+		BenchResult r;
+		r.bytes_per_object = (double)(payload_size + 1);
+		return r;
+	});
+
+	bench_run("shm_pingpong/" + suffix, iterations / 20, [&](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			send('p');
+			reply();
+		}
+		BenchResult r;
+		r.bytes_per_object = (double)(payload_size + 1);
+		return r;
+	});
+
+	down.write((lbyte)'q');
+	down.end_frame();
+	waitpid(pid, NULL, 0);
+}
+#endif
+
+bool parse_options(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+			g_options.quick = true;
+		else if (strcmp(argv[i], "--trace") == 0)
+			g_options.trace = true;
+		else if (strncmp(argv[i], "--filter=", 9) == 0)
+			g_options.filter = argv[i] + 9;
+		else
+		{
+			fprintf(stderr, "usage: %s [--quick] [--filter=<substring>] [--trace]\n", argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	if (!parse_options(argc, argv))
+		return 1;
+	LTrace::set_enabled(g_options.trace);
+
+	const LWireFormat formats[] = { kWire_Fixed, kWire_Compact };
+	for (LWireFormat format : formats)
+	{
+		bench_codec<BenchSmall>("small", format, 2000000);
+		bench_codec<BenchWide>("wide", format, 200000);
+		bench_codec<BenchString>("string", format, 500000);
+		bench_string_view(format, 500000);
+		bench_codec<BenchArray>("array1024", format, 100000);
+		bench_batch<BenchSmall>("small1000", format, 1000, 5000);
+		bench_batch<BenchWide>("wide1000", format, 1000, 500);
+	}
+
+	bench_field_dispatch<BenchWide>("wide", 200000);
+
+	bench_create<BenchSmall>("small", 2000000);
+	bench_create<BenchPooled>("pooled", 2000000);
+	bench_create<BenchWide>("wide", 1000000);
+	bench_create<BenchString>("string", 1000000);
+
+	bench_ref<LRefCountLocal>("local", 20000000);
+	bench_ref<LRefCountAtomic>("atomic", 20000000);
+	for (size_t threads : { 2, 4, 8 })
+		bench_shared_ref_threads(threads, 2000000);
+
+	for (LWireFormat format : formats)
+	{
+		int tree_count = 0;
+		LRef<BenchNode> tree = make_tree(10, tree_count);
+		bench_graph("tree1023", tree, tree_count, format, 2000);
+
+		int chain_count = 0;
+		LRef<BenchNode> chain = make_shared_chain(64, chain_count);
+		bench_graph("shared64", chain, chain_count, format, 50000);
+	}
+
+#ifndef _WIN32
+	bench_snapshot(100000);
+	bench_snapshot_parallel(100000);
+#endif
+
+	check_replica_order(1000, 30);
+	bench_replica_budget(10000, 0, 2000);
+	bench_replica_budget(10000, 16384, 2000);
+	bench_replica_baseline(10000, 0, 2000);
+	bench_replica_baseline(10000, 10, 2000);
+
+#ifdef __linux__
+	bench_tcp(64, 1000000);
+	bench_tcp(4096, 100000);
+	bench_tcp_fanout(1, 1000, 20000);
+	bench_tcp_fanout(16, 1000, 5000);
+	bench_rpc(1, 100000);
+	bench_rpc(64, 2000000);
+	bench_shm(64, 1000000);
+	bench_shm(4096, 100000);
+#endif
+
+#if LROS_TRACE
+	if (g_options.trace)
+		LTrace::dump(std::cerr);
+#endif
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,308 @@
+#ifndef LROS_ARRAY_H_
+#define LROS_ARRAY_H_
+
+#include "lobject.h"
+#include "lstream.h"
+
+#include <algorithm>
+
+//
+// Array Field, see L_FIELD_ARRAY/L_FIELD_REF_ARRAY
+//	- full		: # kArray_Full # count # item... #
+//	- spans		: # kArray_Spans # count # span_count # [start # n # item...]... #
+//	- count, span_count, start and n use the length prefix of the stream
+//	- numeric items are copied in one block where the wire format
+//	  stores them raw, otherwise written one by one through the typed api
+//	- l_serialize always writes full, l_serialize_delta writes the
+//	  changed spans, or full if too many changed
+//
+
+namespace lros
+{
+
+enum LArrayMode
+{
+	kArray_Full		= 0,
+	kArray_Spans	= 1,
+};
+
+struct LArraySpan
+{
+	size_t start;
+	size_t count;
+};
+
+// item compare, refs compare the object
+template<typename T>
+inline bool l_array_same(const T& a, const T& b) { return a == b; }
+template<typename T, typename P>
+inline bool l_array_same(const LRef<T, P>& a, const LRef<T, P>& b) { return a.get() == b.get(); }
+
+// read item i in place, std::vector<bool> has no addressable items
+template<typename T>
+inline bool l_array_read(LStream& s, std::vector<T>& items, size_t i) { return s.read(items[i]); }
+inline bool l_array_read(LStream& s, std::vector<lbool>& items, size_t i)
+{
+	lbool v = false;
+	if (!s.read(v))
+		return false;
+	items[i] = v;
+	return true;
+}
+
+//
+// LArray - std::vector with dirty spans
+//
+template<typename T>
+class LArray
+{
+public:
+	// more changed spans than this are sent as full array
+	static const size_t kMaxSpans = 16;
+
+	LArray() : m_dirty_all(false) {}
+
+	inline const std::vector<T>& items() const { return m_items; }
+	inline std::vector<T>& items() { return m_items; }
+	inline size_t size() const { return m_items.size(); }
+
+	inline void assign(const std::vector<T>& v)
+	{
+		m_items = v;
+		mark_all();
+	}
+	// false if i already holds v
+	inline bool set(size_t i, const T& v)
+	{
+		assert(i < m_items.size() && "Array index out of range!");
+		const T& cur = m_items[i];
+		if (l_array_same(cur, v))
+			return false;
+		m_items[i] = v;
+		mark(i, 1);
+		return true;
+	}
+	// a shrink is sent as the new count
+	inline void resize(size_t n)
+	{
+		size_t old = m_items.size();
+		m_items.resize(n);
+		if (n > old)
+			mark(old, n - old);
+	}
+	inline void push_back(const T& v)
+	{
+		m_items.push_back(v);
+		mark(m_items.size() - 1, 1);
+	}
+
+	inline bool dirty_all() const { return m_dirty_all; }
+	inline const std::vector<LArraySpan>& dirty_spans() const { return m_spans; }
+	inline void clear_dirty()
+	{
+		m_dirty_all = false;
+		m_spans.clear();
+	}
+
+private:
+	inline void mark_all()
+	{
+		m_dirty_all = true;
+		m_spans.clear();
+	}
+	void mark(size_t start, size_t count)
+	{
+		if (m_dirty_all)
+			return;
+		if (!m_spans.empty())
+		{
+			LArraySpan& last = m_spans.back();
+			if (start >= last.start && start <= last.start + last.count)
+			{
+				size_t end = start + count;
+				if (end > last.start + last.count)
+					last.count = end - last.start;
+				return;
+			}
+		}
+		if (m_spans.size() >= kMaxSpans)
+		{
+			mark_all();
+			return;
+		}
+		LArraySpan span = { start, count };
+		m_spans.push_back(span);
+	}
+
+	std::vector<T> m_items;
+	std::vector<LArraySpan> m_spans;	// in mark order, may overlap
+	bool m_dirty_all;
+};
+
+// items copied raw in format f
+template<typename T> struct LArrayRaw { static inline bool value(LWireFormat) { return false; } };
+template<> struct LArrayRaw<lbyte> { static inline bool value(LWireFormat) { return true; } };
+template<> struct LArrayRaw<lfloat> { static inline bool value(LWireFormat) { return true; } };
+template<> struct LArrayRaw<ldouble> { static inline bool value(LWireFormat) { return true; } };
+template<> struct LArrayRaw<lint16> { static inline bool value(LWireFormat f) { return f == kWire_Fixed; } };
+template<> struct LArrayRaw<lint32> { static inline bool value(LWireFormat f) { return f == kWire_Fixed; } };
+template<> struct LArrayRaw<lint64> { static inline bool value(LWireFormat f) { return f == kWire_Fixed; } };
+
+//
+// LArrayCodec - wire encoding of LArray<T>
+//
+template<typename T>
+struct LArrayCodec
+{
+	// upper bound of the item count accepted from the wire
+	static const size_t kMaxWireCount = 0x1000000;
+
+	static bool write(LStream& s, const LArray<T>& a)
+	{
+		lbyte mode = kArray_Full;
+		return s.write(mode) && s.write_length(a.size()) && write_items(s, a.items(), 0, a.size());
+	}
+
+	// changed spans only, then forget them
+	static bool write_delta(LStream& s, LArray<T>& a)
+	{
+		if (a.dirty_all())
+		{
+			a.clear_dirty();
+			return write(s, a);
+		}
+
+		// sort and merge, drop what a shrink cut off
+		std::vector<LArraySpan> spans;
+		spans.reserve(a.dirty_spans().size());
+		for (const auto& span : a.dirty_spans())
+		{
+			if (span.start >= a.size())
+				continue;
+			LArraySpan clamped = { span.start, std::min(span.count, a.size() - span.start) };
+			spans.push_back(clamped);
+		}
+		std::sort(spans.begin(), spans.end(),
+			[](const LArraySpan& l, const LArraySpan& r) { return l.start < r.start; });
+		size_t merged = 0;
+		for (size_t i = 0; i < spans.size(); ++i)
+		{
+			if (merged > 0 && spans[i].start <= spans[merged - 1].start + spans[merged - 1].count)
+			{
+				size_t end = spans[i].start + spans[i].count;
+				if (end > spans[merged - 1].start + spans[merged - 1].count)
+					spans[merged - 1].count = end - spans[merged - 1].start;
+				continue;
+			}
+			spans[merged++] = spans[i];
+		}
+		spans.resize(merged);
+		a.clear_dirty();
+
+		lbyte mode = kArray_Spans;
+		if (!s.write(mode) || !s.write_length(a.size()) || !s.write_length(spans.size()))
+			return false;
+		for (const auto& span : spans)
+		{
+			if (!s.write_length(span.start) || !s.write_length(span.count)
+				|| !write_items(s, a.items(), span.start, span.count))
+				return false;
+		}
+		return true;
+	}
+
+	static bool read(LStream& s, LArray<T>& a)
+	{
+		std::vector<T>& items = a.items();
+		lbyte mode = 0;
+		size_t count = 0;
+		if (!s.read(mode) || !s.read_length(count) || count > kMaxWireCount)
+			return false;
+		if (mode == kArray_Full)
+		{
+			items.resize(count);
+			return read_items(s, items, 0, count);
+		}
+		if (mode != kArray_Spans)
+			return false;
+
+		items.resize(count);
+		size_t span_count = 0;
+		if (!s.read_length(span_count))
+			return false;
+		for (size_t i = 0; i < span_count; ++i)
+		{
+			size_t start = 0, n = 0;
+			if (!s.read_length(start) || !s.read_length(n) || start > count || n > count - start)
+				return false;
+			if (!read_items(s, items, start, n))
+				return false;
+		}
+		return true;
+	}
+
+private:
+	static bool write_items(LStream& s, const std::vector<T>& items, size_t start, size_t n)
+	{
+		if (n == 0)
+			return true;
+		return write_items(s, items, start, n, std::integral_constant<bool, std::is_arithmetic<T>::value
+			&& !std::is_same<T, lbool>::value>());
+	}
+	static bool read_items(LStream& s, std::vector<T>& items, size_t start, size_t n)
+	{
+		if (n == 0)
+			return true;
+		return read_items(s, items, start, n, std::integral_constant<bool, std::is_arithmetic<T>::value
+			&& !std::is_same<T, lbool>::value>());
+	}
+
+	// numeric, raw block copy when the format allows it
+	static bool write_items(LStream& s, const std::vector<T>& items, size_t start, size_t n, std::true_type)
+	{
+		if (LArrayRaw<T>::value(s.wire_format()))
+			return s.write_bytes((const lbyte*)&items[start], n * sizeof(T));
+		for (size_t i = start; i < start + n; ++i)
+		{
+			if (!s.write(items[i]))
+				return false;
+		}
+		return true;
+	}
+	static bool read_items(LStream& s, std::vector<T>& items, size_t start, size_t n, std::true_type)
+	{
+		if (LArrayRaw<T>::value(s.wire_format()))
+			return s.read_bytes((lbyte*)&items[start], n * sizeof(T));
+		for (size_t i = start; i < start + n; ++i)
+		{
+			if (!s.read(items[i]))
+				return false;
+		}
+		return true;
+	}
+
+	// bool, string and ref items
+	static bool write_items(LStream& s, const std::vector<T>& items, size_t start, size_t n, std::false_type)
+	{
+		for (size_t i = start; i < start + n; ++i)
+		{
+			const T& v = items[i];
+			if (!s.write(v))
+				return false;
+		}
+		return true;
+	}
+	static bool read_items(LStream& s, std::vector<T>& items, size_t start, size_t n, std::false_type)
+	{
+		for (size_t i = start; i < start + n; ++i)
+		{
+			if (!l_array_read(s, items, i))
+				return false;
+		}
+		return true;
+	}
+};
+
+}//lros
+
+#endif //LROS_ARRAY_H_
@@ -0,0 +1,718 @@
+#include "lbaseline.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace lros {
+
+namespace {
+
+inline bool same_field(const LObjectState& a, size_t ai, const LObjectState& b, size_t bi)
+{
+	return a.field_id(ai) == b.field_id(bi)
+		&& a.field_size(ai) == b.field_size(bi)
+		&& memcmp(a.field_data(ai), b.field_data(bi), a.field_size(ai)) == 0;
+}
+
+// newer in seq order, seqs wrap
+inline bool seq_newer(luint32 a, luint32 b)
+{
+	return (lint32)(a - b) > 0;
+}
+
+// bit k set if byte k of a xor b is not zero, the xor goes to x
+inline unsigned xor_mask(const lbyte* a, const lbyte* b, size_t size, lbyte* x)
+{
+	unsigned mask = 0;
+	for (size_t k = 0; k < size; ++k)
+	{
+		x[k] = a[k] ^ b[k];
+		if (x[k])
+			mask |= 1u << k;
+	}
+	return mask;
+}
+
+// bytes of the delta of field i of state against field bi of base, about,
+// 0 if they are the same
+inline size_t field_cost(const LObjectState& state, size_t i, const LObjectState& base, size_t bi)
+{
+	size_t size = state.field_size(i);
+	if (size != base.field_size(bi))
+		return 3 + size;
+	const lbyte* a = state.field_data(i);
+	const lbyte* b = base.field_data(bi);
+	if (size > 8)
+		return memcmp(a, b, size) == 0 ? 0 : 3 + size;
+	size_t n = 0;
+	for (size_t k = 0; k < size; ++k)
+		n += a[k] != b[k];
+	if (n == 0)
+		return 0;
+	return n == 8 ? 3 + size : 2 + n;
+}
+
+// bytes of the delta of state against base, about
+size_t delta_cost(const LObjectState& state, const LObjectState& base)
+{
+	size_t cost = 0;
+	size_t bi = 0;
+	for (size_t i = 0; i < state.field_count(); ++i)
+	{
+		while (bi < base.field_count() && base.field_id(bi) != state.field_id(i))
+			++bi;
+		if (bi >= base.field_count())
+		{
+			cost += 3 + state.field_size(i);
+			continue;
+		}
+		cost += field_cost(state, i, base, bi);
+		++bi;
+	}
+	return cost;
+}
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LObjectState
+LObjectState* LObjectState::create(int class_id, const std::vector<int>& field_ids,
+	const std::vector<luint32>& ends, const lbyte* data, size_t size)
+{
+	assert(field_ids.size() == ends.size());
+	size_t count = field_ids.size();
+	void* mem = ::operator new(sizeof(LObjectState) + count * (sizeof(int) + sizeof(luint32)) + size);
+	LObjectState* state = new (mem) LObjectState(class_id, count, size);
+	lbyte* p = reinterpret_cast<lbyte*>(state + 1);
+	if (count > 0)
+	{
+		memcpy(p, &field_ids[0], count * sizeof(int));
+		memcpy(p + count * sizeof(int), &ends[0], count * sizeof(luint32));
+	}
+	if (size > 0)
+		memcpy(p + count * (sizeof(int) + sizeof(luint32)), data, size);
+	return state;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LStateWriter
+LObjectStateRef LStateWriter::capture(const LObject* obj)
+{
+	const LClass* cls = obj->l_class();
+	reset();
+	set_wire_format(kWire_Fixed);
+	m_field_ids.clear();
+	m_ends.clear();
+	m_capturing = true;
+	m_depth = 0;
+	cls->serializer()(*this, obj);
+	m_capturing = false;
+	return LObjectStateRef(LObjectState::create(cls->class_id(), m_field_ids, m_ends, data(), size()));
+}
+
+bool LStateWriter::write_field_id(const int& field_id)
+{
+	if (m_depth > 0 || !m_capturing)
+		return LMemStream::write_field_id(field_id);
+
+	// top level, close the previous field, the ids themselves are not kept
+	if (m_ends.size() < m_field_ids.size())
+		m_ends.push_back((luint32)size());
+	if (field_id >= 0)
+	{
+		m_field_ids.push_back(field_id);
+		ref_cache().clear_written();
+	}
+	return true;
+}
+
+bool LStateWriter::write_object(const LObject* o)
+{
+	++m_depth;
+	bool ok = LMemStream::write_object(o);
+	--m_depth;
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LBaselineHost
+LBaselineHost::LBaselineHost()
+	: m_entries(1), m_live_count(0)
+{
+}
+
+int LBaselineHost::add_object(LObject* obj)
+{
+	assert(obj);
+	int obj_id = 0;
+	if (!m_free_ids.empty())
+	{
+		obj_id = m_free_ids.back();
+		m_free_ids.pop_back();
+	}
+	else
+	{
+		obj_id = (int)m_entries.size();
+		m_entries.push_back(Entry());
+	}
+
+	Entry& e = m_entries[obj_id];
+	e.object = obj;
+	e.state.reset(); // captured by the next capture()
+	++m_live_count;
+
+	// a reused id starts from no state on every slave
+	for (auto& slave : m_slaves)
+	{
+		if (!slave.active || (size_t)obj_id >= slave.entries.size())
+			continue;
+		SlaveEntry& se = slave.entries[obj_id];
+		se.reset_bases();
+		se.sent_seq = 0;
+	}
+	return obj_id;
+}
+
+void LBaselineHost::remove_object(int obj_id)
+{
+	if (obj_id <= 0 || obj_id >= (int)m_entries.size() || !m_entries[obj_id].object)
+		return;
+
+	Entry& e = m_entries[obj_id];
+	e.object = NULL;
+	e.state.reset();
+	e.destroy_acks = 0;
+	--m_live_count;
+
+	for (auto& slave : m_slaves)
+	{
+		if (!slave.active)
+			continue;
+		if ((size_t)obj_id < slave.entries.size())
+		{
+			// keep pending, the id may still be in the pending list
+			SlaveEntry& se = slave.entries[obj_id];
+			se.reset_bases();
+			se.sent_seq = 0;
+		}
+		slave.destroys.push_back(obj_id);
+		++e.destroy_acks;
+	}
+	if (e.destroy_acks == 0)
+		m_free_ids.push_back(obj_id);
+}
+
+LObject* LBaselineHost::find(int obj_id) const
+{
+	if (obj_id <= 0 || obj_id >= (int)m_entries.size())
+		return NULL;
+	return m_entries[obj_id].object;
+}
+
+int LBaselineHost::add_slave()
+{
+	int slave_id = 0;
+	while (slave_id < (int)m_slaves.size() && m_slaves[slave_id].active)
+		++slave_id;
+	if (slave_id == (int)m_slaves.size())
+		m_slaves.push_back(Slave());
+
+	Slave& slave = m_slaves[slave_id];
+	slave = Slave();
+	slave.active = true;
+	// a new slave starts from no state, every object is created
+	for (size_t i = 1; i < m_entries.size(); ++i)
+	{
+		if (m_entries[i].object)
+			mark_pending(slave, (int)i);
+	}
+	return slave_id;
+}
+
+void LBaselineHost::remove_slave(int slave_id)
+{
+	if (slave_id < 0 || slave_id >= (int)m_slaves.size() || !m_slaves[slave_id].active)
+		return;
+
+	Slave& slave = m_slaves[slave_id];
+	for (size_t i = 0; i < slave.destroys.size(); ++i)
+		destroy_acked(slave.destroys[i]);
+	slave = Slave();
+}
+
+size_t LBaselineHost::capture()
+{
+	size_t count = 0;
+	for (size_t i = 1; i < m_entries.size(); ++i)
+	{
+		Entry& e = m_entries[i];
+		if (!e.object || (e.state.get() && !e.object->l_is_dirty()))
+			continue;
+
+		e.state = m_writer.capture(e.object);
+		e.object->l_clear_dirty();
+		for (auto& slave : m_slaves)
+		{
+			if (slave.active)
+				mark_pending(slave, (int)i);
+		}
+		++count;
+	}
+	return count;
+}
+
+luint32 LBaselineHost::write(int slave_id, LStream& s)
+{
+	assert(slave_id >= 0 && slave_id < (int)m_slaves.size() && m_slaves[slave_id].active);
+	Slave& slave = m_slaves[slave_id];
+
+	luint32 seq = slave.next_seq++;
+	if (seq == 0) // 0 is no packet
+		seq = slave.next_seq++;
+
+	SentPacket packet;
+	packet.seq = seq;
+	s.write((lbyte)op_baseline);
+	s.write((lint32)seq);
+
+	// destroys are resent until acked, the slave ignores unknown ids
+	int prev_id = 0;
+	for (size_t i = 0; i < slave.destroys.size(); ++i)
+	{
+		s.write((lbyte)op_destroy);
+		s.write_ref_id(slave.destroys[i] - prev_id);
+		prev_id = slave.destroys[i];
+		packet.destroys.push_back(slave.destroys[i]);
+	}
+
+	// pending stays in about obj_id order, capture() appends ascending ids
+	// and the compaction below keeps the order, the gaps stay small
+	size_t kept = 0;
+	for (size_t i = 0; i < slave.pending.size(); ++i)
+	{
+		int obj_id = slave.pending[i];
+		const Entry& e = m_entries[obj_id];
+		SlaveEntry& se = slave.entries[obj_id];
+		if (!e.object || !e.state.get() || se.bases[0].get() == e.state.get())
+		{
+			// removed, not captured yet, or acked, re-marked on change
+			se.pending = false;
+			continue;
+		}
+		slave.pending[kept++] = obj_id;
+
+		int b = pick_base(se, *e.state.get(), seq);
+		if (b >= 0)
+		{
+			s.write((lbyte)op_replicate_delta);
+			s.write_ref_id(obj_id - prev_id);
+			s.write_length(seq - se.base_seqs[b]);
+		}
+		else
+		{
+			s.write((lbyte)op_create_delta);
+			s.write_type_id(e.state->class_id());
+			s.write_ref_id(obj_id - prev_id);
+		}
+		prev_id = obj_id;
+		write_delta(s, *e.state.get(), b >= 0 ? se.bases[b].get() : NULL);
+
+		se.sent_seq = seq;
+		packet.states.push_back(std::make_pair(obj_id, e.state));
+	}
+	slave.pending.resize(kept);
+	s.write((lbyte)op_end);
+
+	slave.in_flight.push_back(std::move(packet));
+	while (slave.in_flight.size() > kBaselineWindow)
+		slave.in_flight.pop_front();
+	return seq;
+}
+
+void LBaselineHost::ack(int slave_id, luint32 seq)
+{
+	if (slave_id < 0 || slave_id >= (int)m_slaves.size() || !m_slaves[slave_id].active)
+		return;
+
+	Slave& slave = m_slaves[slave_id];
+	// older packets were lost or overtaken, the slave skips them
+	while (!slave.in_flight.empty() && seq_newer(seq, slave.in_flight.front().seq))
+		slave.in_flight.pop_front();
+	if (slave.in_flight.empty() || slave.in_flight.front().seq != seq)
+		return;
+
+	const SentPacket& packet = slave.in_flight.front();
+	for (size_t i = 0; i < packet.states.size(); ++i)
+	{
+		int obj_id = packet.states[i].first;
+		if (!m_entries[obj_id].object)
+			continue; // removed since
+		SlaveEntry& se = slave.entries[obj_id];
+		const LObjectStateRef& state = packet.states[i].second;
+		if (se.bases[0].get() && !seq_newer(seq, se.base_seqs[0]))
+			continue;
+		if (se.bases[0].get() == state.get())
+		{
+			// resent, the slave keeps it under the newer seq as well
+			se.base_seqs[0] = seq;
+			continue;
+		}
+		for (size_t k = kBaselineBases - 1; k > 0; --k)
+		{
+			se.bases[k] = std::move(se.bases[k - 1]);
+			se.base_seqs[k] = se.base_seqs[k - 1];
+		}
+		se.bases[0] = state;
+		se.base_seqs[0] = seq;
+	}
+	for (size_t i = 0; i < packet.destroys.size(); ++i)
+	{
+		auto it = std::find(slave.destroys.begin(), slave.destroys.end(), packet.destroys[i]);
+		if (it == slave.destroys.end())
+			continue;
+		slave.destroys.erase(it);
+		destroy_acked(packet.destroys[i]);
+	}
+	slave.in_flight.pop_front();
+}
+
+size_t LBaselineHost::pending_count(int slave_id) const
+{
+	if (slave_id < 0 || slave_id >= (int)m_slaves.size())
+		return 0;
+	return m_slaves[slave_id].pending.size();
+}
+
+void LBaselineHost::mark_pending(Slave& slave, int obj_id)
+{
+	if ((size_t)obj_id >= slave.entries.size())
+		slave.entries.resize(m_entries.size());
+	SlaveEntry& se = slave.entries[obj_id];
+	if (se.pending)
+		return;
+	se.pending = true;
+	slave.pending.push_back(obj_id);
+}
+
+void LBaselineHost::destroy_acked(int obj_id)
+{
+	Entry& e = m_entries[obj_id];
+	assert(e.destroy_acks > 0);
+	if (--e.destroy_acks == 0)
+		m_free_ids.push_back(obj_id);
+}
+
+int LBaselineHost::pick_base(const SlaveEntry& se, const LObjectState& state, luint32 seq)
+{
+	int best = -1;
+	size_t best_cost = 0;
+	for (size_t i = 0; i < kBaselineBases; ++i)
+	{
+		const LObjectState* base = se.bases[i].get();
+		if (!base || base->class_id() != state.class_id())
+			continue;
+		// the slave keeps the states of the window, and always its newest
+		if (seq - se.base_seqs[i] >= kBaselineWindow && (i > 0 || se.sent_seq != se.base_seqs[0]))
+			continue;
+		size_t cost = delta_cost(state, *base);
+		if (best < 0 || cost < best_cost)
+		{
+			best = (int)i;
+			best_cost = cost;
+			if (cost == 0)
+				break;
+		}
+	}
+	return best;
+}
+
+void LBaselineHost::write_delta(LStream& s, const LObjectState& state, const LObjectState* base)
+{
+	// fields keep their l_serialize order, a base of the same class has the same fields
+	size_t bi = 0;
+	for (size_t i = 0; i < state.field_count(); ++i)
+	{
+		int field_id = state.field_id(i);
+		while (base && bi < base->field_count() && base->field_id(bi) != field_id)
+			++bi;
+		bool has_base = base && bi < base->field_count();
+		if (has_base && same_field(state, i, *base, bi))
+		{
+			++bi;
+			continue;
+		}
+
+		const lbyte* data = state.field_data(i);
+		size_t size = state.field_size(i);
+		s.write_field_id(field_id);
+		lbyte x[8];
+		unsigned mask = (unsigned char)kBaselineTagFull;
+		if (has_base && size <= 8 && size == base->field_size(bi))
+			mask = xor_mask(data, base->field_data(bi), size, x);
+		if (mask != (unsigned char)kBaselineTagFull)
+		{
+			// the changed bytes of the xor only
+			s.write((lbyte)mask);
+			for (size_t k = 0; k < size; ++k)
+			{
+				if (mask & (1u << k))
+					s.write(x[k]);
+			}
+		}
+		else
+		{
+			s.write(kBaselineTagFull);
+			s.write_length(size);
+			s.write_bytes(data, size);
+		}
+		if (has_base)
+			++bi;
+	}
+	s.write_field_id(-1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LBaselineSlave
+LBaselineSlave::LBaselineSlave()
+	: m_seq(0), m_live_count(0)
+{
+}
+
+LBaselineSlave::~LBaselineSlave()
+{
+	clear();
+}
+
+void LBaselineSlave::clear()
+{
+	for (size_t i = 0; i < m_objects.size(); ++i)
+		delete m_objects[i].object;
+	m_objects.clear();
+	m_seq = 0;
+	m_live_count = 0;
+}
+
+LObject* LBaselineSlave::find(int obj_id) const
+{
+	if (obj_id <= 0 || obj_id >= (int)m_objects.size())
+		return NULL;
+	return m_objects[obj_id].object;
+}
+
+bool LBaselineSlave::apply(LStream& s)
+{
+	lbyte op = op_end;
+	lint32 seq = 0;
+	if (!s.read(op) || op != op_baseline || !s.read(seq))
+	{
+		std::cout << "Baseline Error! Invalid packet header" << std::endl;
+		return false;
+	}
+	if (m_seq != 0 && !seq_newer((luint32)seq, m_seq))
+		return true; // stale or duplicate, the host resends what it carried
+	m_seq = (luint32)seq;
+
+	int prev_id = 0;
+	while (true)
+	{
+		if (!s.read(op))
+			return false;
+
+		bool ok = false;
+		int obj_id = 0;
+		switch (op)
+		{
+		case op_end:
+			return true;
+		case op_destroy:
+			ok = read_obj_id(s, prev_id, obj_id);
+			if (ok && find(obj_id))
+				destroy(obj_id);
+			break;
+		case op_create_delta:
+		{
+			int type_id = 0;
+			if (!s.read_type_id(type_id) || !read_obj_id(s, prev_id, obj_id))
+				return false;
+			const LClass* cls = LClass::class_for(type_id);
+			if (!cls || obj_id <= 0 || obj_id > kMaxObjectID)
+			{
+				std::cout << "Baseline Error! Invalid create, class id:" << type_id << " obj_id:" << obj_id << std::endl;
+				return false;
+			}
+			ok = apply_delta(s, obj_id, cls, NULL);
+			break;
+		}
+		case op_replicate_delta:
+		{
+			size_t base_age = 0;
+			if (!read_obj_id(s, prev_id, obj_id) || !s.read_length(base_age))
+				return false;
+			luint32 base_seq = m_seq - (luint32)base_age;
+			LObject* obj = find(obj_id);
+			const LObjectState* base = NULL;
+			if (obj)
+			{
+				// usually one of the newest
+				const auto& states = m_objects[obj_id].states;
+				for (auto it = states.rbegin(); it != states.rend() && !base; ++it)
+				{
+					if (it->first == base_seq)
+						base = it->second.get();
+				}
+			}
+			if (!base)
+			{
+				std::cout << "Baseline Error! Missing base, obj_id:" << obj_id << " seq:" << base_seq << std::endl;
+				return false;
+			}
+			ok = apply_delta(s, obj_id, obj->l_class(), base);
+			break;
+		}
+		default:
+			std::cout << "Baseline Error! Unknown op:" << (int)op << std::endl;
+			break;
+		}
+		if (!ok)
+			return false;
+	}
+}
+
+bool LBaselineSlave::apply_delta(LStream& s, int obj_id, const LClass* cls, const LObjectState* base)
+{
+	// rebuild the new state from the base and the delta
+	m_field_ids.clear();
+	m_ends.clear();
+	m_bytes.clear();
+	size_t bi = 0;
+	while (true)
+	{
+		int field_id = 0;
+		lbyte tag = 0;
+		if (!s.read_field_id(field_id))
+			return false;
+		if (field_id == -1)
+			break;
+		if (!s.read(tag))
+			return false;
+
+		// unchanged fields before this one
+		while (base && bi < base->field_count() && base->field_id(bi) != field_id)
+		{
+			append_field(base->field_id(bi), base->field_data(bi), base->field_size(bi));
+			++bi;
+		}
+		bool has_base = base && bi < base->field_count();
+
+		if (tag == kBaselineTagFull)
+		{
+			size_t len = 0;
+			if (!s.read_length(len))
+				return false;
+			size_t start = m_bytes.size();
+			m_bytes.resize(start + len);
+			if (len > 0 && !s.read_bytes(&m_bytes[start], len))
+				return false;
+			m_field_ids.push_back(field_id);
+			m_ends.push_back((luint32)m_bytes.size());
+		}
+		else
+		{
+			size_t size = has_base ? base->field_size(bi) : 0;
+			unsigned mask = (unsigned char)tag;
+			if (!has_base || size > 8 || (mask >> size) != 0)
+			{
+				std::cout << "Baseline Error! Invalid delta, obj_id:" << obj_id << " field:" << field_id << std::endl;
+				return false;
+			}
+			lbyte field[8];
+			memcpy(field, base->field_data(bi), size);
+			for (size_t k = 0; k < size; ++k)
+			{
+				lbyte x = 0;
+				if (!(mask & (1u << k)))
+					continue;
+				if (!s.read(x))
+					return false;
+				field[k] ^= x;
+			}
+			append_field(field_id, field, size);
+		}
+		if (has_base)
+			++bi;
+	}
+	while (base && bi < base->field_count())
+	{
+		append_field(base->field_id(bi), base->field_data(bi), base->field_size(bi));
+		++bi;
+	}
+
+	LObjectStateRef state(LObjectState::create(cls->class_id(), m_field_ids, m_ends,
+		m_bytes.empty() ? NULL : &m_bytes[0], m_bytes.size()));
+
+	if ((size_t)obj_id >= m_objects.size())
+		m_objects.resize(obj_id + 1);
+	Object& o = m_objects[obj_id];
+	if (o.object && !o.object->l_same_class(cls))
+		destroy(obj_id); // the id was reused, only on create
+	if (!o.object)
+	{
+		o.object = LClass::create_object(cls);
+		++m_live_count;
+	}
+
+	// only the fields that differ from the newest state reach the object
+	const LObjectState* cur = o.states.empty() ? NULL : o.states.back().second.get();
+	m_apply.reset();
+	m_apply.set_wire_format(kWire_Fixed);
+	for (size_t i = 0; i < state->field_count(); ++i)
+	{
+		if (cur && i < cur->field_count() && same_field(*state.get(), i, *cur, i))
+			continue;
+		m_apply.write_field_id(state->field_id(i));
+		m_apply.write_bytes(state->field_data(i), state->field_size(i));
+	}
+	m_apply.write_field_id(-1);
+	bool ok = cls->deserializer()(m_apply, o.object);
+	m_apply.ref_cache().clear();
+	if (!ok)
+		return false;
+
+	o.states.push_back(std::make_pair(m_seq, std::move(state)));
+	while (o.states.size() > 1 && m_seq - o.states.front().first >= kBaselineWindow)
+		o.states.pop_front();
+	return true;
+}
+
+bool LBaselineSlave::read_obj_id(LStream& s, int& prev_id, int& obj_id)
+{
+	int gap = 0;
+	if (!s.read_ref_id(gap))
+		return false;
+	lint64 id = (lint64)prev_id + gap;
+	if (id < 0 || id > kMaxObjectID)
+	{
+		std::cout << "Baseline Error! Invalid obj_id:" << id << std::endl;
+		return false;
+	}
+	obj_id = prev_id = (int)id;
+	return true;
+}
+
+void LBaselineSlave::append_field(int field_id, const lbyte* data, size_t size)
+{
+	m_bytes.insert(m_bytes.end(), data, data + size);
+	m_field_ids.push_back(field_id);
+	m_ends.push_back((luint32)m_bytes.size());
+}
+
+void LBaselineSlave::destroy(int obj_id)
+{
+	Object& o = m_objects[obj_id];
+	delete o.object;
+	o.object = NULL;
+	o.states.clear();
+	--m_live_count;
+}
+
+}//lros
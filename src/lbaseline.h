@@ -0,0 +1,293 @@
+#ifndef LROS_BASELINE_H_
+#define LROS_BASELINE_H_
+
+#include "lobject.h"
+#include "lstream.h"
+#include "lreplica.h"
+
+#include <deque>
+#include <new>
+#include <utility>
+
+//
+// Baseline Replication Packet, one per slave, deltas against acked state
+//	- packet	: # op_baseline # seq # [op]... # op_end #
+//	- create	: # op_create_delta # type_id # obj_gap # delta #, against no state
+//	- replicate	: # op_replicate_delta # obj_gap # base_age # delta #
+//	- destroy	: # op_destroy # obj_gap #
+//	- obj_gap is obj_id - obj_id of the previous op of the packet, a ref id
+//	- delta		: # [field_id # tag # data]... # -1 #
+//	- tag		: bit k set if byte k of (field bytes xor base field bytes) is
+//	  not zero, data is those bytes, for fields of up to 8 bytes
+//	  kBaselineTagFull	: data is # length # field bytes #
+//	- base_age is seq - seq of the acked base, a length
+//	- field bytes are one field as l_serialize writes it in kWire_Fixed
+//	- the host only deltas against states the slave acked, a lost packet
+//	  costs a resend of what it carried, never a broken object
+//	- of the last kBaselineBases acked states the one giving the smallest
+//	  delta is the base, fields that went back to an older value cost nothing
+//
+
+namespace lros
+{
+
+//
+// LObjectState - serialized state of one object, split per field
+//	- immutable, one allocation holds the count, the field table and the bytes
+//	- captured once per change and shared by the baselines of all slaves
+//	- the count is not atomic, a state stays on the thread of its host or slave
+//
+class LObjectState
+{
+public:
+	// a copy of the fields, field i is field_ids[i] and ends at ends[i] in data
+	static LObjectState* create(int class_id, const std::vector<int>& field_ids,
+		const std::vector<luint32>& ends, const lbyte* data, size_t size);
+
+	inline int class_id() const { return m_class_id; }
+	inline size_t field_count() const { return m_field_count; }
+	inline int field_id(size_t i) const { return ids()[i]; }
+	inline const lbyte* field_data(size_t i) const { return data() + (i ? ends()[i - 1] : 0); }
+	inline size_t field_size(size_t i) const { return ends()[i] - (i ? ends()[i - 1] : 0); }
+	inline const lbyte* data() const { return reinterpret_cast<const lbyte*>(ends() + m_field_count); }
+	inline size_t size() const { return m_size; }
+
+	inline void add_ref() { ++m_ref_count; }
+	inline void release()
+	{
+		if (--m_ref_count == 0)
+		{
+			this->~LObjectState();
+			::operator delete(this);
+		}
+	}
+
+private:
+	LObjectState(int class_id, size_t field_count, size_t size)
+		: m_ref_count(0), m_class_id(class_id), m_field_count((luint32)field_count), m_size((luint32)size) {}
+	LObjectState(const LObjectState&);
+	LObjectState& operator=(const LObjectState&);
+
+	inline const int* ids() const { return reinterpret_cast<const int*>(this + 1); }
+	inline const luint32* ends() const { return reinterpret_cast<const luint32*>(ids() + m_field_count); }
+
+	int m_ref_count;
+	int m_class_id;
+	luint32 m_field_count;
+	luint32 m_size;
+};
+
+// reference to an LObjectState
+class LObjectStateRef
+{
+public:
+	LObjectStateRef() : m_state(NULL) {}
+	explicit LObjectStateRef(LObjectState* state) : m_state(state) { if (m_state) m_state->add_ref(); }
+	LObjectStateRef(const LObjectStateRef& other) : m_state(other.m_state) { if (m_state) m_state->add_ref(); }
+	LObjectStateRef(LObjectStateRef&& other) : m_state(other.m_state) { other.m_state = NULL; }
+	~LObjectStateRef() { reset(); }
+
+	LObjectStateRef& operator=(const LObjectStateRef& other)
+	{
+		LObjectStateRef(other).swap(*this);
+		return *this;
+	}
+	LObjectStateRef& operator=(LObjectStateRef&& other)
+	{
+		LObjectStateRef(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	inline const LObjectState* get() const { return m_state; }
+	inline const LObjectState* operator->() const { return m_state; }
+
+	inline void reset()
+	{
+		if (m_state)
+			m_state->release();
+		m_state = NULL;
+	}
+	inline void swap(LObjectStateRef& other) { std::swap(m_state, other.m_state); }
+
+private:
+	LObjectState* m_state;
+};
+
+// kBaselineWindow: a base older than this many packets is only used if
+// nothing newer was sent since, the slave keeps the states of that window
+static const luint32 kBaselineWindow = 64;
+// acked states per object and slave a delta may start from
+static const size_t kBaselineBases = 4;
+// delta tag of a field sent whole, also 8 changed bytes of 8
+static const lbyte kBaselineTagFull = (lbyte)0xff;
+
+//
+// LStateWriter - captures the LObjectState of an object
+//	- runs the full serializer in kWire_Fixed and cuts the bytes at the
+//	  top level field ids, nested objects stay inside their field
+//	- shared refs are written inline once per field, a field never
+//	  back references another one
+//
+class LStateWriter : public LMemStream
+{
+public:
+	LStateWriter() : m_capturing(false), m_depth(0) {}
+
+	LObjectStateRef capture(const LObject* obj);
+
+	virtual bool write_field_id(const int& field_id);
+	virtual bool write_object(const LObject* o);
+
+private:
+	std::vector<int> m_field_ids;	// of the capture
+	std::vector<luint32> m_ends;
+	bool m_capturing;
+	int m_depth;					// nested objects being written
+};
+
+//
+// LBaselineHost - host side, per-slave baselines
+//	- objects are not owned, keep them alive until remove_object()
+//	- per tick: capture() once, then write() a packet for every slave,
+//	  ack() what the slaves report through LBaselineSlave::last_seq()
+//	- an obj_id is reused once every slave acked its destroy
+//
+class LBaselineHost
+{
+public:
+	LBaselineHost();
+
+	int add_object(LObject* obj);
+	void remove_object(int obj_id);
+	LObject* find(int obj_id) const;
+	inline size_t object_count() const { return m_live_count; }
+
+	int add_slave();
+	void remove_slave(int slave_id);
+
+	// capture the objects changed since the last capture and clear their
+	// dirty flags, returns the number captured
+	size_t capture();
+	// write the packet of slave_id, returns its seq
+	luint32 write(int slave_id, LStream& s);
+	// slave_id applied packet seq, older unacked packets count as lost
+	void ack(int slave_id, luint32 seq);
+	// objects slave_id may not have acked the current state of
+	size_t pending_count(int slave_id) const;
+
+private:
+	LBaselineHost(const LBaselineHost&);
+	LBaselineHost& operator=(const LBaselineHost&);
+
+	struct Entry
+	{
+		Entry() : object(NULL), destroy_acks(0) {}
+		LObject* object;
+		LObjectStateRef state;	// last captured
+		int destroy_acks;		// slaves that did not ack the destroy yet
+	};
+
+	struct SlaveEntry
+	{
+		SlaveEntry() : sent_seq(0), pending(false) { reset_bases(); }
+		void reset_bases()
+		{
+			for (size_t i = 0; i < kBaselineBases; ++i)
+			{
+				bases[i].reset();
+				base_seqs[i] = 0;
+			}
+		}
+		LObjectStateRef bases[kBaselineBases];	// acked by the slave, newest first, NULL if none
+		luint32 base_seqs[kBaselineBases];
+		luint32 sent_seq;		// last packet that carried the object
+		bool pending;			// in Slave::pending
+	};
+
+	struct SentPacket
+	{
+		luint32 seq;
+		std::vector<std::pair<int, LObjectStateRef> > states;
+		std::vector<int> destroys;
+	};
+
+	struct Slave
+	{
+		Slave() : active(false), next_seq(1) {}
+		bool active;
+		luint32 next_seq;
+		std::vector<SlaveEntry> entries;	// indexed by obj_id
+		std::vector<int> pending;			// state may differ from base
+		std::vector<int> destroys;			// not acked yet
+		std::deque<SentPacket> in_flight;
+	};
+
+	void mark_pending(Slave& slave, int obj_id);
+	void destroy_acked(int obj_id);
+	// acked state of se the slave still keeps that gives the smallest delta,
+	// -1 if none
+	static int pick_base(const SlaveEntry& se, const LObjectState& state, luint32 seq);
+	// fields of state that differ from base, all of them if base is NULL
+	static void write_delta(LStream& s, const LObjectState& state, const LObjectState* base);
+
+	std::vector<Entry> m_entries;	// indexed by obj_id, slot 0 unused
+	std::vector<int> m_free_ids;
+	std::vector<Slave> m_slaves;
+	size_t m_live_count;
+	LStateWriter m_writer;
+};
+
+//
+// LBaselineSlave - slave side packet applier
+//	- owns the objects it creates
+//	- keeps the recent states of every object as bases for later deltas
+//
+class LBaselineSlave
+{
+public:
+	// upper bound of obj_id accepted from the wire
+	static const int kMaxObjectID = 0xffffff;
+
+	LBaselineSlave();
+	~LBaselineSlave();
+
+	// apply one packet, false on malformed packet, packets older than the
+	// last applied one are ignored
+	bool apply(LStream& s);
+	// seq of the last applied packet, to ack on the host, 0 if none
+	inline luint32 last_seq() const { return m_seq; }
+
+	LObject* find(int obj_id) const;
+	inline size_t object_count() const { return m_live_count; }
+
+	void clear();
+
+private:
+	LBaselineSlave(const LBaselineSlave&);
+	LBaselineSlave& operator=(const LBaselineSlave&);
+
+	struct Object
+	{
+		Object() : object(NULL) {}
+		LObject* object;
+		std::deque<std::pair<luint32, LObjectStateRef> > states;	// by seq, newest last
+	};
+
+	// obj_id from the gap to prev_id, which moves to it
+	static bool read_obj_id(LStream& s, int& prev_id, int& obj_id);
+	bool apply_delta(LStream& s, int obj_id, const LClass* cls, const LObjectState* base);
+	void append_field(int field_id, const lbyte* data, size_t size);
+	void destroy(int obj_id);
+
+	std::vector<Object> m_objects;	// indexed by obj_id
+	luint32 m_seq;
+	size_t m_live_count;
+	LMemStream m_apply;				// changed fields, read by l_deserialize
+	std::vector<int> m_field_ids;	// of the state being decoded
+	std::vector<luint32> m_ends;
+	std::vector<lbyte> m_bytes;
+};
+
+}//lros
+
+#endif //LROS_BASELINE_H_
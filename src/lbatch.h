@@ -0,0 +1,188 @@
+#ifndef LROS_BATCH_H_
+#define LROS_BATCH_H_
+
+#include "lobject.h"
+#include "lstream.h"
+#include "larray.h"
+
+//
+// Columnar Batch, N objects of one class
+//	- batch		: # count # [field_id # column]... # -1 #
+//	- column	: the field of all count objects, in object order
+//	- numeric columns are gathered into a contiguous block and written
+//	  with one write_bytes where the wire format stores them raw,
+//	  compact integers are zigzag varints as in l_serialize
+//	- string, ref and array columns are written value by value
+//
+
+namespace lros
+{
+
+//
+// LColumnCodec - one column, get(i) returns the value of object i
+//
+template<typename V, bool kNumeric = std::is_arithmetic<V>::value && !std::is_same<V, lbool>::value>
+struct LColumnCodec
+{
+	template<typename F>
+	static bool write(LStream& s, size_t n, F get)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (!s.write(get(i)))
+				return false;
+		}
+		return true;
+	}
+
+	template<typename F>
+	static bool read(LStream& s, size_t n, F get)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (!s.read(get(i)))
+				return false;
+		}
+		return true;
+	}
+};
+
+template<typename V>
+struct LColumnCodec<V, true>
+{
+	// gather block, small enough to stay in L1
+	static const size_t kBlock = 256;
+
+	template<typename F>
+	static bool write(LStream& s, size_t n, F get)
+	{
+		V block[kBlock];
+		const bool raw = LArrayRaw<V>::value(s.wire_format());
+		for (size_t base = 0; base < n; base += kBlock)
+		{
+			size_t count = n - base < kBlock ? n - base : kBlock;
+			for (size_t i = 0; i < count; ++i)
+				block[i] = get(base + i);
+
+			if (raw)
+			{
+				if (!s.write_bytes((const lbyte*)block, count * sizeof(V)))
+					return false;
+				continue;
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (!s.write(block[i]))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	template<typename F>
+	static bool read(LStream& s, size_t n, F get)
+	{
+		if (!LArrayRaw<V>::value(s.wire_format()))
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (!s.read(get(i)))
+					return false;
+			}
+			return true;
+		}
+
+		V block[kBlock];
+		for (size_t base = 0; base < n; base += kBlock)
+		{
+			size_t count = n - base < kBlock ? n - base : kBlock;
+			if (!s.read_bytes((lbyte*)block, count * sizeof(V)))
+				return false;
+			for (size_t i = 0; i < count; ++i)
+				get(base + i) = block[i];
+		}
+		return true;
+	}
+};
+
+//
+// LBatch - columnar encoding of objects of class T, driven by its field registry
+//	- T must be the exact class of every object, as for l_serialize
+//
+template<typename T>
+struct LBatch
+{
+	// upper bound of the object count accepted from the wire
+	static const size_t kMaxWireCount = 0x1000000;
+
+	static bool write(LStream& s, const T* const* objs, size_t n)
+	{
+		if (!s.write_length(n))
+			return false;
+		for (const auto& f : T::LDerivedType::__field_registry.field_list)
+		{
+			if (!s.write_field_id(f.field_id) || !f.column_serializer(s, objs, n))
+				return false;
+		}
+		return s.write_field_id(-1);
+	}
+
+	template<typename P>
+	static bool write(LStream& s, const std::vector<LRef<T, P> >& objs)
+	{
+		std::vector<const T*> ptrs(objs.size());
+		for (size_t i = 0; i < objs.size(); ++i)
+			ptrs[i] = objs[i].get();
+		return write(s, ptrs.data(), ptrs.size());
+	}
+
+	// into existing objects, count on the wire must be n
+	static bool read(LStream& s, T* const* objs, size_t n)
+	{
+		size_t count = 0;
+		if (!s.read_length(count) || count != n)
+			return false;
+		return read_columns(s, objs, n);
+	}
+
+	// into new objects appended to objs
+	template<typename P>
+	static bool read(LStream& s, std::vector<LRef<T, P> >& objs)
+	{
+		size_t count = 0;
+		if (!s.read_length(count) || count > kMaxWireCount)
+			return false;
+		std::vector<T*> ptrs(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			ptrs[i] = T::l_new();
+			objs.push_back(LRef<T, P>(ptrs[i]));
+		}
+		return read_columns(s, ptrs.data(), count);
+	}
+
+private:
+	static bool read_columns(LStream& s, T* const* objs, size_t n)
+	{
+		int field_id = -1;
+		while (true)
+		{
+			if (!s.read_field_id(field_id))
+				return false;
+			if (field_id == -1)
+				return true;
+			auto field = T::LDerivedType::__field_registry.get_field(field_id);
+			if (!field)
+			{
+				std::cout << "Class:" << T::l_meta_class()->class_name() << " Error! Invalid Field ID:" << field_id << std::endl;
+				return false;
+			}
+			if (!field->column_deserializer(s, objs, n))
+				return false;
+		}
+	}
+};
+
+}//lros
+
+#endif //LROS_BATCH_H_
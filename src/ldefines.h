@@ -8,6 +8,9 @@
 #include <type_traits>
 #include <iostream>
 #include <cassert>
+#include <atomic>
+#include <bitset>
+#include <cstring>
 
 namespace lros
 {
@@ -17,6 +20,10 @@ static const int kMaxFieldCount = 0xff;
 // Max Field ID NO.
 static const int kMaxFiledIDNum = 0xff;
 
+// Dirty flags of an object, indexed by field id
+typedef std::bitset<kMaxFieldCount> LDirtyFields;
+static_assert(kMaxFiledIDNum <= kMaxFieldCount, "Dirty flags are indexed by field id!");
+
 //
 // LRoleType - indicate the remote role
 //
@@ -38,6 +45,20 @@ enum LRepType
 	kRep_Order		// replicate when dirty, and must make sure the time sequence
 };
 
+// replication priority of a class, see LCLASS_IMPLEMENT_PRIORITY,
+// only used when LReplicaHost has a byte budget
+static const int kRepPriorityDefault = 10;
+
+//
+// LWireFormat
+//	- how a stream encodes ids, lengths and integers
+//
+enum LWireFormat
+{
+	kWire_Fixed,	// fixed width, ids as int32, string length as int16
+	kWire_Compact,	// LEB128 varint ids and lengths, zigzag varint integers
+};
+
 //
 // LTypeID
 //	
@@ -69,6 +90,8 @@ typedef char lbyte;
 typedef short lint16;
 typedef int lint32;
 typedef long long lint64;
+typedef unsigned int luint32;
+typedef unsigned long long luint64;
 typedef float lfloat;
 typedef double ldouble;
 typedef std::string lstring;
@@ -76,7 +99,7 @@ typedef std::string lstring;
 template<typename T> struct LTypeTrait 
 { 
 	static const int kValue = l_void; 
-	static inline T default_value() { return T; }
+	static inline T default_value() { return T(); }
 };
 template<> struct LTypeTrait<lbool> 
 { 
@@ -126,169 +149,257 @@ class LObject;
 class LStream;
 class LClass;
 
-
-class LRefCounter
+//
+// LStringView - read-only string in a buffer owned by someone else,
+//	see LStream::read_string_view
+//
+class LStringView
 {
 public:
-	LRefCounter()
-		: m_ref_id(0), m_ref_count(0)
-	{
-		static int s_counter = 100;
-		m_ref_id = m_ref_id++;
+	LStringView() : m_data(NULL), m_size(0) {}
+	LStringView(const lbyte* data, size_t size) : m_data(data), m_size(size) {}
+
+	inline const lbyte* data() const { return m_data; }
+	inline size_t size() const { return m_size; }
+	inline bool empty() const { return m_size == 0; }
+	inline lstring str() const { return lstring(m_data, m_size); }
+
+	inline bool operator==(const LStringView& rhs) const 
+	{ 
+		return m_size == rhs.m_size && (m_size == 0 || memcmp(m_data, rhs.m_data, m_size) == 0); 
 	}
+	inline bool operator==(const lstring& rhs) const { return *this == LStringView(rhs.data(), rhs.size()); }
+	inline bool operator!=(const LStringView& rhs) const { return !(*this == rhs); }
+	inline bool operator!=(const lstring& rhs) const { return !(*this == rhs); }
+
+private:
+	const lbyte* m_data;
+	size_t m_size;
+};
 
-	LRefCounter(int _ref_id)
-		: m_ref_id(_ref_id), m_ref_count(0)
+
+//
+// Reference count policies
+//	- LRefCountLocal: plain increments, for objects confined to one thread
+//	- LRefCountAtomic: atomic RMW, for objects shared across threads
+//	- all references to a shared object must use LRefCountAtomic
+//
+struct LRefCountLocal
+{
+	static inline int add(std::atomic<int>& count)
 	{
+		int n = count.load(std::memory_order_relaxed) + 1;
+		count.store(n, std::memory_order_relaxed);
+		return n;
 	}
-
-	static LRefCounter* construct_from_ref_id(int _ref_id)
+	static inline int release(std::atomic<int>& count)
 	{
-		assert(_ref_id > 0);
-		return new LRefCounter(_ref_id);
+		int n = count.load(std::memory_order_relaxed) - 1;
+		count.store(n, std::memory_order_relaxed);
+		return n;
 	}
+};
 
-	inline int ref_id() { return m_ref_id; }
-	inline int ref_count() { return m_ref_count; }
-
-	inline int add() { return ++m_ref_count; }
-	inline int release() { return --m_ref_count; }
-
-private:
-	int m_ref_id;
-	int m_ref_count;
+struct LRefCountAtomic
+{
+	static inline int add(std::atomic<int>& count)
+	{
+		return count.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+	static inline int release(std::atomic<int>& count)
+	{
+#if defined(__SANITIZE_THREAD__)
+		// thread sanitizer does not model fences
+		return count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+#else
+		int n = count.fetch_sub(1, std::memory_order_release) - 1;
+		if (n == 0) // see all writes of other owners before delete
+			std::atomic_thread_fence(std::memory_order_acquire);
+		return n;
+#endif
+	}
 };
 
-template<typename T>
+//
+// LRef - intrusive reference to an LObject
+//	- the count lives in the object, no extra allocation per object
+//	- the object is deleted with its last reference
+//	- P selects the count policy, see LRefCountLocal/LRefCountAtomic
+//
+template<typename T, typename P = LRefCountLocal>
 class LRef
 {
 public:
+	typedef P LCountPolicy;
+
 	~LRef()
 	{
-		if (m_counter && m_counter->release() == 0)
-		{
-			assert(m_object);
-			delete m_object;
-			m_object = NULL;
-			delete m_counter;
-			m_counter = NULL;
-		}
+		release();
 	}
 
 	LRef()
-		: m_object(NULL), m_counter(NULL)
+		: m_object(NULL)
 	{
 	}
 
 	LRef(T* object)
 		: m_object(object)
 	{
-		assert(object);
-		m_counter = new LRefCounter;
-		m_counter->add();
+		if (m_object)
+			m_object->template l_add_ref<P>();
+	}
+	LRef(const LRef<T, P>& rhs)
+		: m_object(rhs.m_object)
+	{
+		if (m_object)
+			m_object->template l_add_ref<P>();
+	}
+	LRef(LRef<T, P>&& rhs)
+		: m_object(rhs.m_object)
+	{
+		rhs.m_object = NULL;
 	}
-	LRef(const LRef<T>& rhs)
-		: m_object(rhs.m_object), m_counter(rhs.m_counter)
+	// upcast, e.g. LRef<LObject> from LRef<Derived>, or change policy
+	template<typename U, typename Q>
+	LRef(const LRef<U, Q>& rhs)
+		: m_object(rhs.get())
 	{
-		assert(rhs.m_object && rhs.m_counter);
-		m_counter->add();
+		if (m_object)
+			m_object->template l_add_ref<P>();
 	}
-	LRef<T>& operator=(const LRef<T>& rhs)
+
+	LRef<T, P>& operator=(const LRef<T, P>& rhs)
 	{
-		assert(rhs.m_object && rhs.m_counter);
-		if (rhs.ref_id() == ref_id()) // same ref
+		if (rhs.m_object == m_object) // same ref
 			return *this;
-		if (m_counter && m_counter->release() == 0) // release previous
-		{
-			assert(m_object);
-			delete m_object;
-			m_object = NULL;
-			delete m_counter;
-			m_counter = NULL;
-		}
+		if (rhs.m_object)
+			rhs.m_object->template l_add_ref<P>();
+		release();
 		m_object = rhs.m_object;
-		m_counter = rhs.m_counter;
-		m_counter->add();
 		return *this;
 	}
-
-	inline void set_ref_id(int _id)
+	LRef<T, P>& operator=(LRef<T, P>&& rhs)
 	{
+		if (&rhs == this)
+			return *this;
+		release();
+		m_object = rhs.m_object;
+		rhs.m_object = NULL;
+		return *this;
+	}
 
+	// take over a count already added to object, no add_ref
+	static inline LRef<T, P> adopt(T* object)
+	{
+		LRef<T, P> r;
+		r.m_object = object;
+		return r;
 	}
 
-	inline int ref_id() const 
+	// drop the reference, object is deleted with the last one
+	inline void reset()
 	{
-		return m_counter ? m_counter->ref_id() : 0;
+		release();
+		m_object = NULL;
 	}
 
-	inline T* get()
+	inline int ref_id() const 
 	{
-		return m_object;
+		return m_object ? m_object->l_ref_id() : 0;
 	}
 
-	inline const T* get() const
+	inline int ref_count() const 
 	{
-		return m_object;
+		return m_object ? m_object->l_ref_count() : 0;
 	}
 
-	inline T* operator->()
+	inline T* get() const
 	{
 		return m_object;
 	}
 
-	inline const T* operator->() const
+	inline T* operator->() const
 	{
 		return m_object;
 	}
 
-	inline T& operator*()
+	inline T& operator*() const
 	{
 		return *m_object;
 	}
 
-	inline const T& operator*() const
+private:
+	inline void release()
 	{
-		return *m_object;
+		if (m_object && m_object->template l_release<P>() == 0)
+			delete m_object;
 	}
 
-private:
 	T* m_object;
-	LRefCounter* m_counter;
 };
 
+// reference for objects shared between threads
+template<typename T>
+using LSharedRef = LRef<T, LRefCountAtomic>;
+
+// create an object of class T already held by a reference
+template<typename T, typename P = LRefCountLocal>
+inline LRef<T, P> make_ref()
+{
+	return LRef<T, P>(T::l_new());
+}
+
 // Meta Class Info
 class LClass
 {
 public:
-	typedef std::function<bool(LStream&, const LObject*)> Serializer;
-	typedef std::function<bool(LStream&, LObject*)> Deserializer;
-	typedef std::function<LObject*()> Creater;
-	typedef std::function<void()> Initializer;
+	typedef bool (*Serializer)(LStream&, const LObject*);
+	typedef bool (*DeltaSerializer)(LStream&, LObject*);
+	typedef bool (*Deserializer)(LStream&, LObject*);
+	typedef LObject* (*Creater)();
+	typedef void (*Initializer)();
 
 	LClass(int class_id, const char* class_name, const LClass* super_class,
-		Creater creater, Serializer serializer, Deserializer deserializer, Initializer initializer);
+		Creater creater, Serializer serializer, DeltaSerializer delta_serializer, 
+		Deserializer deserializer, Initializer initializer, 
+		int rep_priority = kRepPriorityDefault);
 
 	inline int class_id() const { return m_class_id; }
 	inline const char* class_name() const { return m_class_name; }
 	inline const LClass* super_class() const { return m_super_class; }
+	inline int rep_priority() const { return m_rep_priority; }
 
 	inline LObject* create_object() { return m_creater(); }
 	inline const Serializer& serializer() const { return m_serializer; }
+	inline const DeltaSerializer& delta_serializer() const { return m_delta_serializer; }
 	inline const Deserializer& deserializer() const { return m_deserializer; }
 
-	static const LClass* class_for(int class_id);
+	inline static const LClass* class_for(int class_id)
+	{
+		if ((unsigned)class_id > (unsigned)kTypeIDUserMax)
+			return NULL;
+		return s_class_table[class_id].load(std::memory_order_acquire);
+	}
 	static LObject* create_object(const LClass* cls);
 	static LObject* create_object(int class_id);
 
+	// adapt C::l_new() to Creater
+	template<typename C>
+	static LObject* create_thunk() { return C::l_new(); }
+
 private:
-	static std::map<int, const LClass*> s_class_map;
+	// class id -> class, indexed directly by class id.
+	// zero-initialized before any dynamic initializer runs, so classes may
+	// register from any translation unit's static init, and readers never lock
+	static std::atomic<const LClass*> s_class_table[kTypeIDUserMax + 1];
 	int m_class_id;
 	const char* m_class_name;
 	const LClass* m_super_class;
 	Creater m_creater;
 	Serializer m_serializer;
+	DeltaSerializer m_delta_serializer;
 	Deserializer m_deserializer;
+	int m_rep_priority;
 };
 
 
@@ -2,24 +2,23 @@
 
 namespace lros {
 
-std::map<int, const LClass*> LClass::s_class_map;
+std::atomic<const LClass*> LClass::s_class_table[kTypeIDUserMax + 1];
 
 const LClass LObject::s_meta_class(
 	(int)l_root, "LObject", NULL,
-	std::bind(
-	&LObject::l_new),
-	std::bind(
+	&LObject::l_new,
 	&LObject::l_serialize,
-	std::placeholders::_1,
-	std::placeholders::_2),
-	std::bind(
+	&LObject::l_serialize_delta,
 	&LObject::l_deserialize,
-	std::placeholders::_1,
-	std::placeholders::_2),
-	std::bind(
-	&LObject::l_static_init)
+	&LObject::l_static_init
 	);
 
+int LObject::l_alloc_ref_id()
+{
+	static std::atomic<int> s_counter(100);
+	return s_counter.fetch_add(1, std::memory_order_relaxed);
+}
+
 const LClass* LObject::l_class() const
 {
 	return &LObject::s_meta_class;
@@ -62,6 +61,12 @@ bool LObject::l_serialize(lros::LStream& s, const LObject* obj)
 	return false;
 }
 
+bool LObject::l_serialize_delta(lros::LStream& s, LObject* obj)
+{
+	assert(0);
+	return false;
+}
+
 bool LObject::l_deserialize(lros::LStream& s, LObject* obj)
 {
 	assert(0);
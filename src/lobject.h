@@ -2,6 +2,8 @@
 #define LROS_OBJECT_H_
 
 #include "ldefines.h"
+#include "lpool.h"
+#include "ltrace.h"
 
 namespace lros {
 //
@@ -10,7 +12,11 @@ namespace lros {
 class LObject
 {
 public:
-	LObject() {};
+	LObject() : m_ref_count(0), m_ref_id(l_alloc_ref_id()) {};
+	// a copy is a new object, never shares count and id
+	LObject(const LObject& rhs) 
+		: m_ref_count(0), m_ref_id(l_alloc_ref_id()), m_dirty_fields(rhs.m_dirty_fields) {};
+	LObject& operator=(const LObject& rhs) { m_dirty_fields = rhs.m_dirty_fields; return *this; }
 	virtual ~LObject() {};
 
 	inline static const LClass* l_meta_class() { return &s_meta_class; }
@@ -20,66 +26,128 @@ public:
 	bool l_same_class(const LClass* cls) const;
 	bool l_same_class(const LObject* obj) const;
 	template<typename T>
-	bool l_same_class() const { return l_same_class(typename T::l_meta_class()); }
+	bool l_same_class() const { return l_same_class(T::l_meta_class()); }
 
 	bool l_instance_of(const LClass* cls) const;
 	bool l_instance_of(const LObject* obj) const;
 	template<typename T>
-	bool l_instance_of() const { return l_instance_of(typename T::l_meta_class()); }
+	bool l_instance_of() const { return l_instance_of(T::l_meta_class()); }
 
 	static void l_static_init() { }
 	
 	static bool l_serialize(lros::LStream& s, const LObject* obj);
+	static bool l_serialize_delta(lros::LStream& s, LObject* obj);
 	static bool l_deserialize(lros::LStream& s, LObject* obj);
 
 	static LObject* l_new() { return NULL; }
 	virtual void l_init() {};
 
+	// dirty tracking, fields are marked by the generated setters
+	inline void l_mark_dirty(int field_id) 
+	{ 
+		if ((unsigned)field_id < (unsigned)kMaxFieldCount) 
+			m_dirty_fields[field_id] = true; 
+	}
+	inline bool l_is_dirty() const { return m_dirty_fields.any(); }
+	inline bool l_is_dirty(int field_id) const { return m_dirty_fields[field_id]; }
+	inline void l_clear_dirty() { m_dirty_fields.reset(); }
+	inline const LDirtyFields& l_dirty_fields() const { return m_dirty_fields; }
+
+	// intrusive reference count, P is the count policy of LRef
+	inline int l_ref_id() const { return m_ref_id; }
+	inline int l_ref_count() const { return m_ref_count.load(std::memory_order_relaxed); }
+	template<typename P>
+	inline int l_add_ref() { return P::add(m_ref_count); }
+	template<typename P>
+	inline int l_release() { return P::release(m_ref_count); }
+
 	template<typename T>
 	static inline void __register_fields() {}
 	static inline int __fields_reserved() { return -1; }
 
 private:
+	static int l_alloc_ref_id();
+
 	static const LClass s_meta_class;
+	std::atomic<int> m_ref_count;
+	int m_ref_id;
+	LDirtyFields m_dirty_fields;
 };
 
 // Class field data
+//	- accessors are plain function pointers, so dispatch is a direct call
 template<typename T>
 struct LField
 {
-	typedef std::function<bool(LStream&, const T&)> Serializer;
-	typedef std::function<bool(LStream&, T&)> Deserializer;
-	typedef std::function<void(T&)> Initializer;
-	LField() : field_id(0), field_name(NULL) {}
+	typedef bool (*Serializer)(LStream&, const T&);
+	// may clear change tracking kept inside the field, e.g. array spans
+	typedef bool (*DeltaSerializer)(LStream&, T&);
+	typedef bool (*Deserializer)(LStream&, T&);
+	typedef void (*Initializer)(T&);
+	// the field of n objects as one column, see lbatch.h
+	typedef bool (*ColumnSerializer)(LStream&, const T* const*, size_t);
+	typedef bool (*ColumnDeserializer)(LStream&, T* const*, size_t);
+	LField() : field_id(0), field_name(NULL), serializer(NULL), delta_serializer(NULL), 
+		deserializer(NULL), initializer(NULL), column_serializer(NULL), column_deserializer(NULL) {}
+
+	// adapt accessors of declaring class C to class T (T is C or derived from C),
+	// the accessor is a template argument and can be inlined into the thunk
+	template<typename C, bool (*F)(LStream&, const C&)>
+	static bool serialize_thunk(LStream& s, const T& obj) { return F(s, obj); }
+	template<typename C, bool (*F)(LStream&, C&)>
+	static bool delta_serialize_thunk(LStream& s, T& obj) { return F(s, obj); }
+	template<typename C, bool (*F)(LStream&, C&)>
+	static bool deserialize_thunk(LStream& s, T& obj) { return F(s, obj); }
+	template<typename C, void (*F)(C&)>
+	static void initialize_thunk(T& obj) { F(obj); }
 
 	int field_id;
 	const char* field_name;
 	Serializer serializer;
+	DeltaSerializer delta_serializer;
 	Deserializer deserializer;
 	Initializer initializer;
+	ColumnSerializer column_serializer;
+	ColumnDeserializer column_deserializer;
 };
 
 template<typename T>
 struct LFieldRegistry
 {
 	std::vector<lros::LField<T> > field_list;
-	std::map<int, lros::LField<T> > field_map;
+	// field id -> index in field_list, -1 if not registered
+	lint16 field_index[kMaxFiledIDNum];
 	int fields_reserved;
 
-	LFieldRegistry() : fields_reserved(-1) {}
+	LFieldRegistry() : fields_reserved(-1) 
+	{
+		for (int i = 0; i < kMaxFiledIDNum; ++i)
+			field_index[i] = -1;
+	}
 
-	inline lros::LField<T>* get_field(int field_id)
+	inline void add_field(const lros::LField<T>& field)
 	{
-		auto fit = field_map.find(field_id); 
-		if (fit == field_map.end()) 
-		{ 
-			std::cout << "Class:TestMember" << " Error! Invalid Field ID:" << field_id << std::endl; 
-			return NULL; 
-		} 
-		return &fit->second;
+		assert(field.field_id >= 0 && field.field_id < kMaxFiledIDNum);
+		field_index[field.field_id] = (lint16)field_list.size();
+		field_list.push_back(field);
+	}
+
+	inline const lros::LField<T>* get_field(int field_id) const
+	{
+		if ((unsigned)field_id >= (unsigned)kMaxFiledIDNum)
+			return NULL;
+		int index = field_index[field_id];
+		return index < 0 ? NULL : &field_list[index];
 	}
 };
 
+}//lros
+
+// LStream needs a complete LObject, LDerivedObject needs a complete LStream
+#include "lstream.h"
+
+namespace lros {
+
 // LDerivedObject
 template<typename T, typename S = lros::LObject>
 class LDerivedObject : public S
@@ -95,55 +163,108 @@ public:
 	virtual const lros::LClass* l_class() const { return &LDerivedType::__meta_class; }
 	inline static const lros::LClass* l_meta_class() { return &LDerivedType::__meta_class; }
 	static void l_static_init() { __register_fields<LClassType>(); }
+	// slab pool of this class, NULL if not pooled, see LCLASS_IMPLEMENT_POOL
+	static lros::LObjectPool* l_object_pool();
 	static LClassType* l_new() 
 	{ 
-		LClassType* obj = new LClassType;
+		// allocate and construct in two steps, a new-expression pairs the class
+		// operator new with the sized operator delete, which gcc reports
+		void* mem = l_alloc(sizeof(LClassType));
+		LClassType* obj = NULL;
+		try
+		{
+			obj = ::new (mem) LClassType;
+		}
+		catch (...)
+		{
+			l_free(mem, sizeof(LClassType));
+			throw;
+		}
 		LClassType::l_constructor(obj);
 		return obj; 
 	}
 
 	static void l_constructor(LClassType* obj) 
 	{ 
-		std::cout << __FUNCTION__ << std::endl; 
-		for(auto f : LClassType::__field_registry.field_list) 
+		LROS_TRACE_SCOPE(trace, &LDerivedType::__meta_class, lros::kTrace_Construct, 0);
+		for(const auto& f : LClassType::__field_registry.field_list) 
 		{
 			f.initializer(*obj);
 		} 
 
 		obj->l_init();
+		obj->l_clear_dirty();
 	}
 
 	static bool l_serialize(lros::LStream& s, const lros::LObject* obj) 
 	{ 
-		std::cout << __FUNCTION__ << std::endl; 
+		LROS_TRACE_SCOPE(trace, &LDerivedType::__meta_class, lros::kTrace_Serialize, s.bytes_written());
 		assert(obj->l_same_class<LClassType>() && "Serialized Object Class Must Same!"); 
 		const LClassType& dobj = dynamic_cast<const LClassType&>(*obj); 
 		
-		for(auto f : LClassType::__field_registry.field_list) 
+		for(const auto& f : LClassType::__field_registry.field_list) 
 		{ 
+			LROS_TRACE_FIELD_BEGIN(trace, s.bytes_written());
 			s.write_field_id(f.field_id); 
 			f.serializer(s, dobj); 
+			LROS_TRACE_FIELD_END(trace, f.field_id, s.bytes_written());
 		} 
 		s.write_field_id(-1); 
+		LROS_TRACE_END(trace, s.bytes_written());
+		return true; 
+	} 
+	// write dirty fields only, then clear them. 
+	// same layout as l_serialize, so l_deserialize applies it
+	static bool l_serialize_delta(lros::LStream& s, lros::LObject* obj) 
+	{ 
+		LROS_TRACE_SCOPE(trace, &LDerivedType::__meta_class, lros::kTrace_SerializeDelta, s.bytes_written());
+		assert(obj->l_same_class<LClassType>() && "Serialized Object Class Must Same!"); 
+		LClassType& dobj = dynamic_cast<LClassType&>(*obj); 
+		
+		if (dobj.l_is_dirty())
+		{
+			for(const auto& f : LClassType::__field_registry.field_list) 
+			{ 
+				if (!dobj.l_is_dirty(f.field_id))
+					continue;
+				LROS_TRACE_FIELD_BEGIN(trace, s.bytes_written());
+				s.write_field_id(f.field_id); 
+				f.delta_serializer(s, dobj); 
+				LROS_TRACE_FIELD_END(trace, f.field_id, s.bytes_written());
+			} 
+			dobj.l_clear_dirty();
+		}
+		s.write_field_id(-1); 
+		LROS_TRACE_END(trace, s.bytes_written());
 		return true; 
 	} 
 	static bool l_deserialize(lros::LStream& s, LObject* obj) 
 	{ 
-		std::cout << __FUNCTION__ << std::endl; 
+		LROS_TRACE_SCOPE(trace, &LDerivedType::__meta_class, lros::kTrace_Deserialize, s.bytes_read());
 		assert(obj->l_same_class<LClassType>() && "Deserialized Object Class Must Same!"); 
 		LClassType& dobj = dynamic_cast<LClassType&>(*obj); 
 		
 		int field_id = -1; 
-		for(s.read_field_id(field_id); field_id != -1; s.read_field_id(field_id)) 
+		LROS_TRACE_FIELD_BEGIN(trace, s.bytes_read());
+		while (true)
 		{ 
+			if (!s.read_field_id(field_id))
+				return false;
+			if (field_id == -1)
+				break;
 			auto field = __field_registry.get_field(field_id);
 			if (!field) 
 			{ 
-				std::cout << "Class:TestMember" << " Error! Invalid Field ID:" << field_id << std::endl; 
+				std::cout << "Class:" << l_meta_class()->class_name() << " Error! Invalid Field ID:" << field_id << std::endl; 
 				return false; 
 			} 
-			field->deserializer(s, dobj); 
+			// the stream position is lost once a field fails
+			if (!field->deserializer(s, dobj))
+				return false;
+			LROS_TRACE_FIELD_END(trace, field_id, s.bytes_read());
+			LROS_TRACE_FIELD_BEGIN(trace, s.bytes_read());
 		} 
+		LROS_TRACE_END(trace, s.bytes_read());
 		return true; 
 	}
 
@@ -156,8 +277,8 @@ public:
 	static inline void __register_fields() 
 	{ 
 		static_assert(std::is_base_of<lros::LObject, LClassType>::value, "Inherit Path Must include LObject!"); 
-		LSuperClassType::__register_fields<D>(); 
-		LClassType::__register_fields_impl<D>();
+		LSuperClassType::template __register_fields<D>(); 
+		LClassType::template __register_fields_impl<D>();
 	} 
 	static inline int __get_super_fieldid_reserved() 
 	{ 
@@ -165,10 +286,24 @@ public:
 	} 
 
 private:
-	static void* operator new(size_t _size)
+	static void* l_alloc(size_t _size)
 	{
-		return ::operator new(_size);
+		lros::LObjectPool* pool = l_object_pool();
+		return pool ? pool->alloc(_size) : ::operator new(_size);
 	}
+	static void l_free(void* p, size_t _size)
+	{
+		lros::LObjectPool* pool = l_object_pool();
+		if (pool)
+			pool->free(p, _size);
+		else
+			::operator delete(p);
+	}
+	static void* operator new(size_t _size) { return l_alloc(_size); }
+
+public:
+	// found through the virtual destructor, so it matches operator new
+	static void operator delete(void* p, size_t _size) { l_free(p, _size); }
 };
 
 }//lros
@@ -0,0 +1,213 @@
+#include "lpool.h"
+
+#include <cstddef>
+
+namespace lros {
+
+static std::atomic<LObjectPool*> s_pools[LObjectPool::kMaxPools];
+static std::atomic<size_t> s_pool_count(0);
+
+thread_local LObjectPool::FreeList LObjectPool::s_thread_lists[LObjectPool::kMaxPools];
+thread_local bool LObjectPool::s_thread_exited = false;
+
+//
+// returns the thread free lists to the pool depots when the thread exits
+//
+struct LObjectPool::ThreadExit
+{
+	~ThreadExit()
+	{
+		size_t count = pool_count();
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (s_thread_lists[i].head)
+				s_pools[i].load(std::memory_order_acquire)->drain(s_thread_lists[i], 0);
+		}
+		s_thread_exited = true;
+	}
+};
+
+LObjectPool::FreeList* LObjectPool::thread_list(size_t index)
+{
+	if (s_thread_exited)
+		return NULL;
+	static thread_local ThreadExit t_exit;
+	(void)t_exit;
+	return &s_thread_lists[index];
+}
+
+LObjectPool* LObjectPool::create(const char* name, size_t object_size, size_t slab_objects)
+{
+	size_t index = s_pool_count.fetch_add(1, std::memory_order_relaxed);
+	assert(index < kMaxPools && "Too many pooled classes, raise kMaxPools!");
+	if (index >= kMaxPools)
+		return NULL;
+
+	LObjectPool* pool = new LObjectPool(name, object_size, slab_objects, index);
+	s_pools[index].store(pool, std::memory_order_release);
+	return pool;
+}
+
+size_t LObjectPool::pool_count()
+{
+	size_t count = s_pool_count.load(std::memory_order_acquire);
+	return count < kMaxPools ? count : kMaxPools;
+}
+
+LObjectPool* LObjectPool::pool_at(size_t index)
+{
+	if (index >= pool_count())
+		return NULL;
+	return s_pools[index].load(std::memory_order_acquire);
+}
+
+LObjectPool::LObjectPool(const char* name, size_t object_size, size_t slab_objects, size_t index)
+	: m_name(name), m_object_size(object_size), m_slab_objects(slab_objects), m_index(index),
+	m_slabs(0), m_live(0), m_high_water(0)
+{
+	// keep every object aligned like ::operator new does
+	const size_t align = alignof(std::max_align_t);
+	if (m_object_size < sizeof(Node))
+		m_object_size = sizeof(Node);
+	m_object_size = (m_object_size + align - 1) / align * align;
+	if (m_slab_objects < kBatchCount)
+		m_slab_objects = kBatchCount;
+
+	m_depot.head = NULL;
+	m_depot.count = 0;
+}
+
+void* LObjectPool::alloc(size_t size)
+{
+	// subclasses without their own pool are larger than the slot
+	if (size > m_object_size)
+		return ::operator new(size);
+
+	FreeList* list = thread_list(m_index);
+	Node* n = NULL;
+	if (list)
+	{
+		if (!list->head)
+			refill(*list);
+		n = list->head;
+		list->head = n->next;
+		--list->count;
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_depot.head)
+			add_slab();
+		n = m_depot.head;
+		m_depot.head = n->next;
+		--m_depot.count;
+	}
+
+	size_t live = m_live.fetch_add(1, std::memory_order_relaxed) + 1;
+	size_t high = m_high_water.load(std::memory_order_relaxed);
+	while (live > high && !m_high_water.compare_exchange_weak(high, live, std::memory_order_relaxed))
+	{
+	}
+	return n;
+}
+
+void LObjectPool::free(void* p, size_t size)
+{
+	if (!p)
+		return;
+	if (size > m_object_size)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	m_live.fetch_sub(1, std::memory_order_relaxed);
+	Node* n = static_cast<Node*>(p);
+	FreeList* list = thread_list(m_index);
+	if (!list)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		n->next = m_depot.head;
+		m_depot.head = n;
+		++m_depot.count;
+		return;
+	}
+
+	n->next = list->head;
+	list->head = n;
+	++list->count;
+
+	// objects freed on another thread than allocated flow back in batches
+	if (list->count >= 2 * kBatchCount)
+		drain(*list, kBatchCount);
+}
+
+void LObjectPool::preallocate(size_t count)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	while (m_depot.count < count)
+		add_slab();
+}
+
+LObjectPool::Stats LObjectPool::stats() const
+{
+	Stats s;
+	s.live = m_live.load(std::memory_order_relaxed);
+	s.high_water = m_high_water.load(std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		s.slabs = m_slabs;
+	}
+	s.bytes = s.slabs * m_slab_objects * m_object_size;
+	return s;
+}
+
+void LObjectPool::take_batch(FreeList& list, size_t count)
+{
+	while (count-- && m_depot.head)
+	{
+		Node* n = m_depot.head;
+		m_depot.head = n->next;
+		--m_depot.count;
+		n->next = list.head;
+		list.head = n;
+		++list.count;
+	}
+}
+
+void LObjectPool::add_slab()
+{
+	lbyte* slab = static_cast<lbyte*>(::operator new(m_slab_objects * m_object_size));
+	for (size_t i = m_slab_objects; i > 0; --i)
+	{
+		Node* n = reinterpret_cast<Node*>(slab + (i - 1) * m_object_size);
+		n->next = m_depot.head;
+		m_depot.head = n;
+	}
+	m_depot.count += m_slab_objects;
+	++m_slabs;
+}
+
+void LObjectPool::refill(FreeList& list)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_depot.head)
+		add_slab();
+	take_batch(list, kBatchCount);
+}
+
+void LObjectPool::drain(FreeList& list, size_t keep)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	while (list.count > keep)
+	{
+		Node* n = list.head;
+		list.head = n->next;
+		--list.count;
+		n->next = m_depot.head;
+		m_depot.head = n;
+		++m_depot.count;
+	}
+}
+
+}//lros
@@ -0,0 +1,98 @@
+#ifndef LROS_POOL_H_
+#define LROS_POOL_H_
+
+#include "ldefines.h"
+
+#include <mutex>
+
+namespace lros
+{
+
+//
+// LObjectPool - fixed size slab allocator for one LROS class
+//	- enabled per class by LCLASS_IMPLEMENT_POOL
+//	- each thread allocates from and frees to its own free list,
+//	  batches move between threads through the shared depot
+//	- slabs are never returned to the system, pools live until exit
+//
+class LObjectPool
+{
+public:
+	// max number of pooled classes
+	static const size_t kMaxPools = 256;
+	// objects moved between a thread free list and the depot at once
+	static const size_t kBatchCount = 32;
+
+	struct Stats
+	{
+		size_t live;		// objects in use
+		size_t high_water;	// max objects in use at once
+		size_t slabs;		// slabs allocated
+		size_t bytes;		// bytes reserved by slabs
+	};
+
+	// pools are never destroyed, objects may be freed during static destruction
+	static LObjectPool* create(const char* name, size_t object_size, size_t slab_objects);
+
+	static size_t pool_count();
+	static LObjectPool* pool_at(size_t index);
+
+	void* alloc(size_t size);
+	void free(void* p, size_t size);
+
+	// make sure count objects can be allocated without a new slab
+	void preallocate(size_t count);
+
+	Stats stats() const;
+	inline const char* name() const { return m_name; }
+	inline size_t object_size() const { return m_object_size; }
+
+private:
+	struct Node
+	{
+		Node* next;
+	};
+
+	struct FreeList
+	{
+		Node* head;
+		size_t count;
+	};
+
+	struct ThreadExit;
+	friend struct ThreadExit;
+
+	LObjectPool(const char* name, size_t object_size, size_t slab_objects, size_t index);
+	LObjectPool(const LObjectPool&);
+	LObjectPool& operator=(const LObjectPool&);
+
+	// free list of the calling thread, NULL once the thread is exiting
+	static FreeList* thread_list(size_t index);
+
+	// plain data, so they stay valid for objects freed during static destruction
+	static thread_local FreeList s_thread_lists[kMaxPools];
+	static thread_local bool s_thread_exited;
+
+	// move up to count objects from depot to list, caller holds m_mutex
+	void take_batch(FreeList& list, size_t count);
+	// carve a new slab into the depot, caller holds m_mutex
+	void add_slab();
+	void refill(FreeList& list);
+	void drain(FreeList& list, size_t keep);
+
+	const char* m_name;
+	size_t m_object_size;
+	size_t m_slab_objects;
+	size_t m_index;
+
+	mutable std::mutex m_mutex;
+	FreeList m_depot;
+	size_t m_slabs;
+
+	std::atomic<size_t> m_live;
+	std::atomic<size_t> m_high_water;
+};
+
+}//lros
+
+#endif //LROS_POOL_H_
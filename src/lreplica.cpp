@@ -0,0 +1,461 @@
+#include "lreplica.h"
+
+#include <algorithm>
+
+namespace lros {
+
+//////////////////////////////////////////////////////////////////////////
+// LReplicaHost
+LReplicaHost::LReplicaHost()
+	: m_entries(1), m_live_count(0), m_budget(0), m_tick(0), m_deferred(0), m_max_wait(0), m_op_size(0)
+{
+}
+
+int LReplicaHost::add_object(LObject* obj, LRepType rep_type)
+{
+	assert(obj);
+	if (rep_type == kRep_Never)
+		return 0;
+
+	int obj_id = 0;
+	if (!m_free_ids.empty())
+	{
+		obj_id = m_free_ids.back();
+		m_free_ids.pop_back();
+	}
+	else
+	{
+		obj_id = (int)m_entries.size();
+		m_entries.push_back(Entry());
+	}
+
+	Entry& e = m_entries[obj_id];
+	e.object = obj;
+	e.rep_type = rep_type;
+	e.state = kState_Create;
+	++m_live_count;
+	return obj_id;
+}
+
+void LReplicaHost::remove_object(int obj_id)
+{
+	if (obj_id <= 0 || obj_id >= (int)m_entries.size())
+		return;
+
+	Entry& e = m_entries[obj_id];
+	switch (e.state)
+	{
+	case kState_Free:
+		return;
+	case kState_Create: // slaves never saw it
+		m_free_ids.push_back(obj_id);
+		break;
+	case kState_Live:
+		m_destroyed.push_back(obj_id);
+		break;
+	case kState_TornOff: // slave keeps it, never reuse the id
+		break;
+	}
+	e = Entry();
+	--m_live_count;
+}
+
+LObject* LReplicaHost::find(int obj_id) const
+{
+	if (obj_id <= 0 || obj_id >= (int)m_entries.size())
+		return NULL;
+	return m_entries[obj_id].object;
+}
+
+size_t LReplicaHost::flush(LStream& s)
+{
+	size_t ops = 0;
+	size_t start = s.bytes_written();
+	// shared refs are written once per packet
+	s.ref_cache().clear_written();
+
+	// destroys go first, so the ids can be reused by creates
+	for (size_t i = 0; i < m_destroyed.size(); ++i)
+	{
+		s.write((lbyte)op_destroy);
+		s.write_ref_id(m_destroyed[i]);
+		m_free_ids.push_back(m_destroyed[i]);
+		++ops;
+	}
+	m_destroyed.clear();
+
+	if (m_budget > 0)
+	{
+		ops += flush_scheduled(s, start);
+	}
+	else
+	{
+		for (size_t obj_id = 1; obj_id < m_entries.size(); ++obj_id)
+		{
+			Entry& e = m_entries[obj_id];
+			if (e.state == kState_Create || (e.state == kState_Live && e.object->l_is_dirty()))
+			{
+				write_entry(s, (int)obj_id, e);
+				e.waiting = false;
+				++ops;
+			}
+		}
+		m_deferred = 0;
+		m_max_wait = 0;
+	}
+
+	s.write((lbyte)op_end);
+	// the slave drops its ref table at op_end
+	s.ref_cache().clear_written();
+	++m_tick;
+	return ops;
+}
+
+size_t LReplicaHost::flush_scheduled(LStream& s, size_t start)
+{
+	m_candidates.clear();
+	m_max_wait = 0;
+	for (size_t obj_id = 1; obj_id < m_entries.size(); ++obj_id)
+	{
+		Entry& e = m_entries[obj_id];
+		if (e.state != kState_Create && (e.state != kState_Live || !e.object->l_is_dirty()))
+		{
+			e.waiting = false;
+			continue;
+		}
+		if (!e.waiting)
+		{
+			e.waiting = true;
+			e.since = m_tick;
+		}
+		luint32 wait = m_tick - e.since;
+		if (wait > m_max_wait)
+			m_max_wait = wait;
+
+		// slaves see nothing of an object before its create
+		Candidate c;
+		c.score = (luint64)e.object->l_class()->rep_priority() * (wait + 1) 
+			* (e.state == kState_Create ? 2 : 1);
+		c.obj_id = (int)obj_id;
+		m_candidates.push_back(c);
+	}
+	auto by_score = [](const Candidate& a, const Candidate& b)
+	{
+		return a.score != b.score ? a.score > b.score : a.obj_id < b.obj_id;
+	};
+	// only the head that may fit is ordered, from the op size of the last flush
+	size_t count = m_candidates.size();
+	size_t head = count;
+	if (m_op_size > 0)
+		head = std::min(count, 2 * m_budget / m_op_size + 16);
+	if (head < count)
+		std::nth_element(m_candidates.begin(), m_candidates.begin() + head, m_candidates.end(), by_score);
+	std::sort(m_candidates.begin(), m_candidates.begin() + head, by_score);
+
+	size_t ops = 0;
+	m_deferred = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (i == head)
+			std::sort(m_candidates.begin() + head, m_candidates.end(), by_score);
+		// strictly by score, a smaller object further down does not jump ahead
+		size_t used = s.bytes_written() - start;
+		Entry& e = m_entries[m_candidates[i].obj_id];
+		// a create has no last op yet, it is sized by a trial encoding
+		if (e.last_size == 0 && e.state == kState_Create)
+		{
+			m_scratch.reset();
+			m_scratch.ref_cache().clear_written();
+			m_scratch.set_wire_format(s.wire_format());
+			write_create(m_scratch, m_candidates[i].obj_id, e.object);
+			e.last_size = (luint32)m_scratch.size();
+		}
+		// op_end has to fit as well
+		if (used >= m_budget || (ops > 0 && used + e.last_size + 1 > m_budget))
+		{
+			m_deferred = count - i;
+			break;
+		}
+		size_t before = s.bytes_written();
+		write_entry(s, m_candidates[i].obj_id, e);
+		e.last_size = (luint32)(s.bytes_written() - before);
+		e.waiting = false;
+		++ops;
+	}
+	if (ops > 0)
+		m_op_size = std::max<size_t>(1, (s.bytes_written() - start) / ops);
+	return ops;
+}
+
+void LReplicaHost::write_entry(LStream& s, int obj_id, Entry& e)
+{
+	if (e.state == kState_Create)
+	{
+		write_create(s, obj_id, e.object);
+		e.object->l_clear_dirty();
+		e.state = e.rep_type == kRep_Create ? kState_TornOff : kState_Live;
+		e.seq = 0;
+		return;
+	}
+	if (e.rep_type == kRep_Order)
+	{
+		write_ordered(s, obj_id, e);
+		return;
+	}
+	s.write((lbyte)op_replicate);
+	s.write_ref_id(obj_id);
+	e.object->l_class()->delta_serializer()(s, e.object);
+}
+
+void LReplicaHost::write_create(LStream& s, int obj_id, LObject* obj)
+{
+	const LClass* cls = obj->l_class();
+	s.write((lbyte)op_create);
+	s.write_type_id(cls->class_id());
+	s.write_ref_id(obj_id);
+	cls->serializer()(s, obj);
+}
+
+LSegmentRef LReplicaHost::flush_segment(LWireFormat format)
+{
+	m_packet.reset();
+	m_packet.set_wire_format(format);
+	if (flush(m_packet) == 0)
+		return LSegmentRef();
+	return LSegmentRef::create(m_packet.data(), m_packet.size());
+}
+
+void LReplicaHost::write_ordered(LStream& s, int obj_id, Entry& e)
+{
+	// pack is length-prefixed so an early slave can buffer it as raw bytes
+	m_scratch.reset();
+	m_scratch.ref_cache().clear_written();
+	m_scratch.set_wire_format(s.wire_format());
+	e.object->l_class()->delta_serializer()(m_scratch, e.object);
+
+	s.write((lbyte)op_replicate_order);
+	s.write_ref_id(obj_id);
+	s.write(++e.seq);
+	s.write((lint32)m_scratch.size());
+	s.write_bytes(m_scratch.data(), m_scratch.size());
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LReplicaSlave
+LReplicaSlave::LReplicaSlave()
+	: m_pending_count(0), m_pending_bytes(0), m_live_count(0)
+{
+}
+
+LReplicaSlave::~LReplicaSlave()
+{
+	clear();
+}
+
+void LReplicaSlave::clear()
+{
+	for (size_t i = 0; i < m_objects.size(); ++i)
+	{
+		delete m_objects[i];
+	}
+	m_objects.clear();
+	m_order.clear();
+	m_pending_count = m_pending_bytes = 0;
+	m_live_count = 0;
+}
+
+LObject* LReplicaSlave::find(int obj_id) const
+{
+	if (obj_id <= 0 || obj_id >= (int)m_objects.size())
+		return NULL;
+	return m_objects[obj_id];
+}
+
+bool LReplicaSlave::apply(LStream& s)
+{
+	// refs of a packet only back reference the same packet
+	bool ok = apply_ops(s);
+	s.ref_cache().clear();
+	return ok;
+}
+
+bool LReplicaSlave::apply_ops(LStream& s)
+{
+	for (;;)
+	{
+		lbyte op = op_end;
+		if (!s.read(op))
+			return false;
+
+		bool ok = false;
+		switch (op)
+		{
+		case op_end:
+			return true;
+		case op_create:
+			ok = apply_create(s);
+			break;
+		case op_destroy:
+			ok = apply_destroy(s);
+			break;
+		case op_replicate:
+			ok = apply_replicate(s);
+			break;
+		case op_replicate_order:
+			ok = apply_replicate_order(s);
+			break;
+		default:
+			std::cout << "Replica Error! Invalid op:" << (int)op << std::endl;
+			break;
+		}
+		if (!ok)
+			return false;
+	}
+}
+
+bool LReplicaSlave::apply_create(LStream& s)
+{
+	int type_id = 0, obj_id = 0;
+	if (!s.read_type_id(type_id) || !s.read_ref_id(obj_id))
+		return false;
+	if (obj_id <= 0 || obj_id > kMaxObjectID || find(obj_id))
+	{
+		std::cout << "Replica Error! Invalid create obj_id:" << obj_id << std::endl;
+		return false;
+	}
+
+	LObject* obj = LClass::create_object(type_id);
+	if (!obj)
+	{
+		std::cout << "Replica Error! Invalid class id:" << type_id << std::endl;
+		return false;
+	}
+
+	if ((size_t)obj_id >= m_objects.size())
+		m_objects.resize(obj_id + 1, NULL);
+	m_objects[obj_id] = obj;
+	++m_live_count;
+
+	if (!obj->l_class()->deserializer()(s, obj))
+		return false;
+	// ordered updates may have overtaken the create
+	return apply_pending(obj_id, s.wire_format());
+}
+
+bool LReplicaSlave::apply_destroy(LStream& s)
+{
+	int obj_id = 0;
+	if (!s.read_ref_id(obj_id))
+		return false;
+
+	LObject* obj = find(obj_id);
+	if (!obj)
+		return true; // already gone, e.g. torn-off or never created
+	delete obj;
+	m_objects[obj_id] = NULL;
+	drop_order(obj_id);
+	--m_live_count;
+	return true;
+}
+
+bool LReplicaSlave::apply_replicate(LStream& s)
+{
+	int obj_id = 0;
+	if (!s.read_ref_id(obj_id))
+		return false;
+
+	LObject* obj = find(obj_id);
+	if (!obj)
+	{
+		std::cout << "Replica Error! Unknown obj_id:" << obj_id << std::endl;
+		return false;
+	}
+	return obj->l_class()->deserializer()(s, obj);
+}
+
+bool LReplicaSlave::apply_replicate_order(LStream& s)
+{
+	int obj_id = 0;
+	lint32 seq = 0, len = 0;
+	if (!s.read_ref_id(obj_id) || !s.read(seq) || !s.read(len))
+		return false;
+	if (obj_id <= 0 || obj_id > kMaxObjectID || len < 0 || len > kMaxOrderPackSize)
+	{
+		std::cout << "Replica Error! Invalid ordered update, obj_id:" << obj_id << " len:" << len << std::endl;
+		return false;
+	}
+
+	LObject* obj = find(obj_id);
+	auto it = m_order.find(obj_id);
+	lint32 last = it == m_order.end() ? 0 : it->second.seq;
+	if (obj && seq == last + 1)
+	{
+		// in order, apply straight from the packet
+		if (!obj->l_class()->deserializer()(s, obj))
+			return false;
+		if (it == m_order.end())
+			it = m_order.insert(std::make_pair(obj_id, OrderState())).first;
+		it->second.seq = seq;
+		return apply_pending(obj_id, s.wire_format());
+	}
+
+	std::vector<lbyte> pack(len);
+	if (len > 0 && !s.read_bytes(&pack[0], len))
+		return false;
+	if (seq <= last)
+		return true; // stale or duplicate
+	if ((it != m_order.end() && it->second.pending.size() >= kMaxPendingOrder)
+		|| m_pending_count >= kMaxPendingOrderTotal || m_pending_bytes + pack.size() > kMaxPendingOrderBytes)
+	{
+		std::cout << "Replica Error! Too many pending updates, obj_id:" << obj_id << std::endl;
+		return false;
+	}
+	if (it == m_order.end())
+		it = m_order.insert(std::make_pair(obj_id, OrderState())).first;
+	auto slot = it->second.pending.insert(std::make_pair(seq, std::vector<lbyte>()));
+	if (!slot.second)
+		return true; // duplicate, already buffered
+	slot.first->second.swap(pack);
+	++m_pending_count;
+	m_pending_bytes += slot.first->second.size();
+	return true;
+}
+
+bool LReplicaSlave::apply_pending(int obj_id, LWireFormat format)
+{
+	auto oit = m_order.find(obj_id);
+	if (oit == m_order.end())
+		return true;
+
+	OrderState& state = oit->second;
+	LObject* obj = find(obj_id);
+	LMemStream pack(0);
+	pack.set_wire_format(format);
+	while (obj && !state.pending.empty() && state.pending.begin()->first == state.seq + 1)
+	{
+		auto pit = state.pending.begin();
+		pack.assign(pit->second.empty() ? NULL : &pit->second[0], pit->second.size());
+		if (!obj->l_class()->deserializer()(pack, obj))
+			return false;
+		state.seq = pit->first;
+		--m_pending_count;
+		m_pending_bytes -= pit->second.size();
+		state.pending.erase(pit);
+	}
+	return true;
+}
+
+void LReplicaSlave::drop_order(int obj_id)
+{
+	auto it = m_order.find(obj_id);
+	if (it == m_order.end())
+		return;
+	for (const auto& pending : it->second.pending)
+	{
+		--m_pending_count;
+		m_pending_bytes -= pending.second.size();
+	}
+	m_order.erase(it);
+}
+
+}//lros
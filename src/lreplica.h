@@ -0,0 +1,191 @@
+#ifndef LROS_REPLICA_H_
+#define LROS_REPLICA_H_
+
+#include "lobject.h"
+#include "lstream.h"
+#include "lsegment.h"
+
+//
+// Replication Packet
+//	- packet		: # [op]... # op_end #
+//	- create		: # op_create # type_id # obj_id # replicate pack #
+//	- destroy		: # op_destroy # obj_id #
+//	- replicate		: # op_replicate # obj_id # replicate pack #
+//	- ordered		: # op_replicate_order # obj_id # seq # pack_len # replicate pack #
+//	- replicate pack is the field list written by l_serialize/l_serialize_delta
+//	- obj_id is written with the ref id encoding of the stream
+//
+
+namespace lros
+{
+
+//
+// LOpType - replication and rpc packet operations
+//
+enum LOpType
+{
+	op_end		= 0,	// end of packet
+	op_create	= 1,
+	op_destroy	= 2,
+	op_replicate= 3,
+	op_replicate_order = 4,	// kRep_Order objects, sequenced per object
+	op_rpc		= 5,	// rpc call, see lrpc.h
+	op_rpc_reply= 6,
+	op_baseline	= 7,	// baseline packet header, see lbaseline.h
+	op_create_delta = 8,
+	op_replicate_delta = 9,
+};
+
+//
+// LReplicaHost - host side replication manager
+//	- objects are not owned, keep them alive until remove_object()
+//	- flush() batches all changes since last flush into one packet,
+//	  changes made between two flushes are coalesced by the dirty flags
+//	- kRep_Order objects carry a per-object sequence number
+//	- with a byte budget, flush() sends creates and dirty objects by score:
+//	  class rep_priority x (1 + flushes waited), doubled for creates, until
+//	  the budget is used, the others stay dirty and score higher next time
+//
+class LReplicaHost
+{
+public:
+	LReplicaHost();
+
+	// start replicating obj, returns obj_id (0 if never replicated)
+	int add_object(LObject* obj, LRepType rep_type = kRep_Normal);
+	// stop replicating, slaves destroy their copy on next flush
+	void remove_object(int obj_id);
+
+	LObject* find(int obj_id) const;
+	inline size_t object_count() const { return m_live_count; }
+
+	// write pending destroys, creates and dirty objects as one packet,
+	// returns number of ops written
+	size_t flush(LStream& s);
+	// flush() into an immutable segment, encoded once and queued on the
+	// streams of every slave, empty if there was nothing to send
+	LSegmentRef flush_segment(LWireFormat format = kWire_Fixed);
+
+	// packet bytes per flush, 0 sends every change in obj_id order,
+	// an object is sent alone if it is larger than the budget, the stream
+	// must count bytes_written(); an update is sized by its last op, a
+	// create by a trial encoding
+	inline void set_budget(size_t bytes) { m_budget = bytes; }
+	inline size_t budget() const { return m_budget; }
+	// objects the last flush left for later
+	inline size_t deferred_count() const { return m_deferred; }
+	// most flushes a pending object had waited at the last flush
+	inline luint32 max_wait() const { return m_max_wait; }
+
+private:
+	enum EntryState
+	{
+		kState_Free,
+		kState_Create,		// created, not flushed yet
+		kState_Live,		// replicating
+		kState_TornOff,		// kRep_Create sent, slave owns it now
+	};
+
+	struct Entry
+	{
+		Entry() : object(NULL), rep_type(kRep_Never), state(kState_Free), seq(0),
+			waiting(false), since(0), last_size(0) {}
+		LObject* object;
+		LRepType rep_type;
+		EntryState state;
+		lint32 seq;			// last sequence sent, kRep_Order only
+		bool waiting;		// pending since flush number since
+		luint32 since;
+		luint32 last_size;	// bytes of the last op or trial create, estimate for the budget
+	};
+
+	struct Candidate
+	{
+		luint64 score;
+		int obj_id;
+	};
+
+	// op_create or op_replicate of a pending entry
+	void write_entry(LStream& s, int obj_id, Entry& e);
+	// op_create with the full object, no state change
+	void write_create(LStream& s, int obj_id, LObject* obj);
+	void write_ordered(LStream& s, int obj_id, Entry& e);
+	// pending entries by score until the budget is used, start is where the packet began
+	size_t flush_scheduled(LStream& s, size_t start);
+
+	std::vector<Entry> m_entries;	// indexed by obj_id, slot 0 unused
+	std::vector<int> m_free_ids;	// destroyed ids, reusable after flush
+	std::vector<int> m_destroyed;	// ids waiting for op_destroy
+	size_t m_live_count;
+	LMemStream m_scratch;			// ordered packs and creates are sized before writing
+	LMemStream m_packet;			// encodes flush_segment()
+
+	size_t m_budget;
+	luint32 m_tick;					// flushes so far
+	size_t m_deferred;
+	luint32 m_max_wait;
+	size_t m_op_size;				// average op of the last scheduled flush
+	std::vector<Candidate> m_candidates;
+};
+
+//
+// LReplicaSlave - slave side packet applier
+//	- owns the objects it creates
+//	- kRep_Order updates that arrive early are buffered and applied 
+//	  once the missing sequence numbers are in, stale ones are dropped
+//
+class LReplicaSlave
+{
+public:
+	// upper bound of obj_id accepted from the wire
+	static const int kMaxObjectID = 0xffffff;
+	// upper bound of buffered out-of-order updates per object
+	static const size_t kMaxPendingOrder = 64;
+	// upper bound of buffered out-of-order updates of all objects, and of
+	// their bytes, early updates of unknown objects count as well
+	static const size_t kMaxPendingOrderTotal = 65536;
+	static const size_t kMaxPendingOrderBytes = 16 * 1024 * 1024;
+	// upper bound of one ordered pack accepted from the wire, the tcp frame limit
+	static const lint32 kMaxOrderPackSize = 16 * 1024 * 1024;
+
+	LReplicaSlave();
+	~LReplicaSlave();
+
+	// apply one packet, false on malformed packet
+	bool apply(LStream& s);
+
+	LObject* find(int obj_id) const;
+	inline size_t object_count() const { return m_live_count; }
+
+	void clear();
+
+private:
+	LReplicaSlave(const LReplicaSlave&);
+	LReplicaSlave& operator=(const LReplicaSlave&);
+
+	bool apply_ops(LStream& s);
+	bool apply_create(LStream& s);
+	bool apply_destroy(LStream& s);
+	bool apply_replicate(LStream& s);
+	bool apply_replicate_order(LStream& s);
+	bool apply_pending(int obj_id, LWireFormat format);
+	// forget the ordered state of obj_id and its buffered updates
+	void drop_order(int obj_id);
+
+	struct OrderState
+	{
+		OrderState() : seq(0) {}
+		lint32 seq;	// last applied sequence, create is 0
+		std::map<lint32, std::vector<lbyte> > pending;
+	};
+
+	std::vector<LObject*> m_objects;	// indexed by obj_id
+	std::map<int, OrderState> m_order;	// kRep_Order objects only
+	size_t m_pending_count;				// buffered updates in m_order
+	size_t m_pending_bytes;
+	size_t m_live_count;
+};
+
+}//lros
+
+#endif //LROS_REPLICA_H_
@@ -3,29 +3,22 @@
 namespace lros {
 
 LClass::LClass(int class_id, const char* class_name, const LClass* super_class,
-			   Creater creater, Serializer serializer, Deserializer deserializer, Initializer initializer)
+			   Creater creater, Serializer serializer, DeltaSerializer delta_serializer, 
+			   Deserializer deserializer, Initializer initializer, int rep_priority)
 	: m_class_id(class_id), m_class_name(class_name), m_super_class(super_class),
-	m_creater(creater), m_serializer(serializer), m_deserializer(deserializer)
+	m_creater(creater), m_serializer(serializer), m_delta_serializer(delta_serializer), 
+	m_deserializer(deserializer), m_rep_priority(rep_priority)
 {
-	assert((class_id > lros::kTypeIDBasicMax && class_id <= lros::kTypeIDUserMax) || class_id == l_root
+	assert(rep_priority > 0 && "Replication priority must > 0!");
+	assert(((class_id > lros::kTypeIDBasicMax && class_id <= lros::kTypeIDUserMax) || class_id == l_root)
 		&& "Class ID Error! Make sure - kTypeBasicMax < ClassID < kTypeUserMax !!");
-	assert(s_class_map.find(class_id) == s_class_map.end() 
+	assert(class_for(class_id) == NULL
 		&& "LClass ID conflict! Make sure this id never used before!");
 
-	s_class_map[class_id] = this;
+	s_class_table[class_id].store(this, std::memory_order_release);
 	initializer();
 }
 
-const LClass* LClass::class_for(int class_id)
-{
-	auto cit = s_class_map.find(class_id);
-	if (cit == s_class_map.end())
-	{
-		return NULL;
-	}
-	return cit->second;
-}
-
 LObject* LClass::create_object(const LClass* cls)
 {
 	assert(cls);
@@ -40,5 +33,14 @@ LObject* LClass::create_object(int class_id)
 	return create_object(cls);
 }
 
+bool LBufferStream::grow_put_bytes(const lbyte* buf, size_t len)
+{
+	if (!grow(len))
+		return false;
+	memcpy(m_put_cur, buf, len);
+	m_put_cur += len;
+	return true;
+}
+
 
 }//lros
@@ -7,6 +7,16 @@
 
 #include "lobject.h"
 #include "lstream.h"
+#include "lreplica.h"
+#include "lsnapshot.h"
+#include "lsegment.h"
+#include "lworkpool.h"
+#include "ltcp.h"
+#include "lshm.h"
+#include "lrpc.h"
+#include "lbaseline.h"
+#include "larray.h"
+#include "lbatch.h"
 
 //
 // LROS Types
@@ -14,20 +24,19 @@
 //	2.LROS Reference
 //	3.Meta Data
 //
-//	TODO:
-//	- array support, access, replicate
-//	- ensure LClass class map init first, init static member use new
-//
 
 //
 // Serialization
-//	* TODO List: !!!! 
 //	- type define: op_type, type_id(class_id), obj_id, slot_id, slot_value(data)
 //	- replicate pack: # obj_id # [ [slot_id # slot_value] | [(ref)slot_id # (ref)obj_id # [slot_id # slot_value]... ]... #
 //	- when create	: # (op_type)op_create # type_id # replicate pack #
 //	- when destroy	: # (op_type)op_destroy # obj_id #
 //	- when replicate: # (op_type)op_replicate # obj_id # replicate pack #
-//	- ??rpc service	: # (op_type)op_rpc # ??
+//	- see LReplicaHost/LReplicaSlave in lreplica.h
+//	- rpc call		: # (op_type)op_rpc # service_id # method_id # request_id # body_len # args #
+//	- rpc reply		: # (op_type)op_rpc_reply # request_id # status # body_len # result #
+//	- see LRpcClient/LRpcServer in lrpc.h
+//	- baseline		: per-slave field deltas against acked state, see LBaselineHost in lbaseline.h
 //
 
 //
@@ -45,7 +54,7 @@ template<typename C>
 inline void _lros_dump_class_info()
 {
 	std::cout << "===== [" << C::l_meta_class()->class_name() << "] Info =====" << std::endl;
-	for (auto f: C::LDerivedType::__field_registry.field_list)
+	for (const auto& f: C::LDerivedType::__field_registry.field_list)
 	{
 		std::cout << f.field_id << "\t" << f.field_name << std::endl;
 	}
@@ -53,21 +62,34 @@ inline void _lros_dump_class_info()
 }
 
 #define LCLASS_IMPLEMENT(class_id, class_name) \
-	lros::LFieldRegistry<class_name> class_name::LDerivedType::__field_registry; \
-	const lros::LClass class_name::LDerivedType::__meta_class( \
+	__LCLASS_IMPLEMENT(class_id, class_name, NULL, lros::kRepPriorityDefault) \
+
+// allocate objects from a per-class slab pool, slab_objects objects per slab
+#define LCLASS_IMPLEMENT_POOL(class_id, class_name, slab_objects) \
+	__LCLASS_IMPLEMENT(class_id, class_name, \
+		lros::LObjectPool::create(#class_name, sizeof(class_name), slab_objects), \
+		lros::kRepPriorityDefault) \
+
+// replication priority > 0, relative to kRepPriorityDefault, see LReplicaHost::set_budget
+#define LCLASS_IMPLEMENT_PRIORITY(class_id, class_name, priority) \
+	__LCLASS_IMPLEMENT(class_id, class_name, NULL, priority) \
+
+#define __LCLASS_IMPLEMENT(class_id, class_name, object_pool, priority) \
+	template<> lros::LObjectPool* class_name::LDerivedType::l_object_pool() \
+	{ \
+		static lros::LObjectPool* s_pool = object_pool; \
+		return s_pool; \
+	} \
+	template<> lros::LFieldRegistry<class_name> class_name::LDerivedType::__field_registry = \
+		lros::LFieldRegistry<class_name>(); \
+	template<> const lros::LClass class_name::LDerivedType::__meta_class( \
 		class_id, #class_name, class_name::LSuperClassType::l_meta_class(), \
-		std::bind( \
-		&class_name::LDerivedType::l_new), \
-		std::bind( \
+		&lros::LClass::create_thunk<class_name::LDerivedType>, \
 		&class_name::LDerivedType::l_serialize, \
-		std::placeholders::_1, \
-		std::placeholders::_2), \
-		std::bind( \
+		&class_name::LDerivedType::l_serialize_delta, \
 		&class_name::LDerivedType::l_deserialize, \
-		std::placeholders::_1, \
-		std::placeholders::_2), \
-		std::bind( \
-		&class_name::LDerivedType::l_static_init) \
+		&class_name::LDerivedType::l_static_init, \
+		priority \
 		); \
 
 //////////////////////////////////////////////////////////////////////////
@@ -94,24 +116,22 @@ public: \
 	lros::LField<T> _field; \
 	_field.field_id = id; \
 	_field.field_name = #name; \
-	_field.serializer = std::bind( \
-	&T::__serialize_##name, \
-	std::placeholders::_1,  \
-	std::placeholders::_2); \
-	_field.deserializer = std::bind( \
-	&T::__deserialize_##name, \
-	std::placeholders::_1,  \
-	std::placeholders::_2); \
-	_field.initializer = std::bind( \
-	&T::__initialize_##name, \
-	std::placeholders::_1); \
-	T::LDerivedType::__field_registry.field_list.push_back(_field); \
-	assert(T::LDerivedType::__field_registry.field_list.size() < lros::kMaxFieldCount \
+	_field.serializer = &lros::LField<T>::template serialize_thunk< \
+		LClassType, &LClassType::__serialize_##name>; \
+	_field.delta_serializer = &lros::LField<T>::template delta_serialize_thunk< \
+		LClassType, &LClassType::__serialize_delta_##name>; \
+	_field.deserializer = &lros::LField<T>::template deserialize_thunk< \
+		LClassType, &LClassType::__deserialize_##name>; \
+	_field.initializer = &lros::LField<T>::template initialize_thunk< \
+		LClassType, &LClassType::__initialize_##name>; \
+	_field.column_serializer = &LClassType::template __serialize_column_##name<T>; \
+	_field.column_deserializer = &LClassType::template __deserialize_column_##name<T>; \
+	assert(T::LDerivedType::__field_registry.field_list.size() + 1 < lros::kMaxFieldCount \
 		&& "LROS class fields count must < kMaxFieldCount!"); \
-	assert(T::LDerivedType::__field_registry.field_map.find(id) \
-		==  T::LDerivedType::__field_registry.field_map.end() \
+	assert(T::LDerivedType::__field_registry.get_field(id) == NULL \
 		&& "Field id conflict, check if id is already used in this or super class!"); \
-	T::LDerivedType::__field_registry.field_map[id] = _field; \
+	T::LDerivedType::__field_registry.add_field(_field); \
+	LClassType::__field_id_##name() = id; \
 } \
 
 #define __L_FIELD_STD(name, type, defaultv) \
@@ -119,21 +139,39 @@ private:	\
 	type __##name; \
 public:		\
 	type get_##name() const { return __##name; } \
-	void set_##name(const type& ##name) { __##name = ##name; } \
+	void set_##name(const type& v) \
+	{ \
+		if (__##name == v) \
+			return; \
+		__##name = v; \
+		l_mark_dirty(__field_id_##name()); \
+	} \
+	static int& __field_id_##name() { static int s_field_id = -1; return s_field_id; } \
 	static bool __serialize_##name(lros::LStream& s, const LClassType& e) \
 	{ \
 		static_assert(lros::LTypeTrait<type>::kValue!=lros::l_void, "Invalid std type, see LType list for supported std types!"); \
-		std::cout << __FUNCTION__ << std::endl; \
 		return s.write(e.__##name); \
 	} \
+	static bool __serialize_delta_##name(lros::LStream& s, LClassType& e) \
+	{ \
+		return __serialize_##name(s, e); \
+	} \
 	static bool __deserialize_##name(lros::LStream& s, LClassType& e) \
 	{ \
-		std::cout << __FUNCTION__ << std::endl; \
 		return s.read(e.__##name); \
 	} \
+	template<typename O> \
+	static bool __serialize_column_##name(lros::LStream& s, const O* const* objs, size_t n) \
+	{ \
+		return lros::LColumnCodec<type>::write(s, n, [objs](size_t i) -> const type& { return objs[i]->__##name; }); \
+	} \
+	template<typename O> \
+	static bool __deserialize_column_##name(lros::LStream& s, O* const* objs, size_t n) \
+	{ \
+		return lros::LColumnCodec<type>::read(s, n, [objs](size_t i) -> type& { return objs[i]->__##name; }); \
+	} \
 	static void __initialize_##name(LClassType& e) \
 	{ \
-		std::cout << __FUNCTION__ << std::endl; \
 		e.__##name = defaultv; \
 	} \
 
@@ -149,20 +187,38 @@ private:	\
 	ref_type __##name; \
 public:		\
 	ref_type& get_##name() { return __##name; } \
-	void set_##name(const ref_type& ##name) { __##name = ##name; } \
+	void set_##name(const ref_type& v) \
+	{ \
+		if (__##name.get() == v.get()) \
+			return; \
+		__##name = v; \
+		l_mark_dirty(__field_id_##name()); \
+	} \
+	static int& __field_id_##name() { static int s_field_id = -1; return s_field_id; } \
 	static bool __serialize_##name(lros::LStream& s, const LClassType& e) \
 	{ \
-		std::cout << __FUNCTION__ << std::endl; \
 		return s.write(e.__##name); \
 	} \
+	static bool __serialize_delta_##name(lros::LStream& s, LClassType& e) \
+	{ \
+		return __serialize_##name(s, e); \
+	} \
 	static bool __deserialize_##name(lros::LStream& s, LClassType& e) \
 	{ \
-		std::cout << __FUNCTION__ << std::endl; \
 		return s.read(e.__##name); \
 	} \
+	template<typename O> \
+	static bool __serialize_column_##name(lros::LStream& s, const O* const* objs, size_t n) \
+	{ \
+		return lros::LColumnCodec<ref_type>::write(s, n, [objs](size_t i) -> const ref_type& { return objs[i]->__##name; }); \
+	} \
+	template<typename O> \
+	static bool __deserialize_column_##name(lros::LStream& s, O* const* objs, size_t n) \
+	{ \
+		return lros::LColumnCodec<ref_type>::read(s, n, [objs](size_t i) -> ref_type& { return objs[i]->__##name; }); \
+	} \
 	static void __initialize_##name(LClassType& e) \
 	{ \
-		std::cout << __FUNCTION__ << std::endl; \
 		if (new_in_default) \
 			e.__##name = ref_type(raw_type::l_new()); \
 	} \
@@ -173,6 +229,90 @@ public:		\
 #define L_FIELD_REF_NEW(name, ref_type) \
 	__L_FIELD_REF(name, lros::LRef<ref_type>, ref_type, true) \
 
+//////////////////////////////////////////////////////////////////////////
+// array fields, std::vector of a basic type or of LRef, see larray.h
+//	- set_x_at/resize_x/push_back_x record the changed spans,
+//	  l_serialize_delta sends only those
+//	- spans recorded before the field was last cleared, e.g. by a full
+//	  l_serialize and l_clear_dirty, are dropped on the next change
+#define __L_FIELD_ARRAY(name, item_type) \
+private:	\
+	lros::LArray<item_type> __##name; \
+	lros::LArray<item_type>& __changing_##name() \
+	{ \
+		if (!l_is_dirty(__field_id_##name())) \
+			__##name.clear_dirty(); \
+		return __##name; \
+	} \
+public:		\
+	const std::vector<item_type>& get_##name() const { return __##name.items(); } \
+	void set_##name(const std::vector<item_type>& v) \
+	{ \
+		__changing_##name().assign(v); \
+		l_mark_dirty(__field_id_##name()); \
+	} \
+	void set_##name##_at(size_t i, const item_type& v) \
+	{ \
+		if (__changing_##name().set(i, v)) \
+			l_mark_dirty(__field_id_##name()); \
+	} \
+	void resize_##name(size_t n) \
+	{ \
+		if (n == __##name.size()) \
+			return; \
+		__changing_##name().resize(n); \
+		l_mark_dirty(__field_id_##name()); \
+	} \
+	void push_back_##name(const item_type& v) \
+	{ \
+		__changing_##name().push_back(v); \
+		l_mark_dirty(__field_id_##name()); \
+	} \
+	static int& __field_id_##name() { static int s_field_id = -1; return s_field_id; } \
+	static bool __serialize_##name(lros::LStream& s, const LClassType& e) \
+	{ \
+		return lros::LArrayCodec<item_type>::write(s, e.__##name); \
+	} \
+	static bool __serialize_delta_##name(lros::LStream& s, LClassType& e) \
+	{ \
+		return lros::LArrayCodec<item_type>::write_delta(s, e.__##name); \
+	} \
+	static bool __deserialize_##name(lros::LStream& s, LClassType& e) \
+	{ \
+		return lros::LArrayCodec<item_type>::read(s, e.__##name); \
+	} \
+	template<typename O> \
+	static bool __serialize_column_##name(lros::LStream& s, const O* const* objs, size_t n) \
+	{ \
+		for (size_t i = 0; i < n; ++i) \
+		{ \
+			if (!lros::LArrayCodec<item_type>::write(s, objs[i]->__##name)) \
+				return false; \
+		} \
+		return true; \
+	} \
+	template<typename O> \
+	static bool __deserialize_column_##name(lros::LStream& s, O* const* objs, size_t n) \
+	{ \
+		for (size_t i = 0; i < n; ++i) \
+		{ \
+			if (!lros::LArrayCodec<item_type>::read(s, objs[i]->__##name)) \
+				return false; \
+		} \
+		return true; \
+	} \
+	static void __initialize_##name(LClassType& e) \
+	{ \
+		e.__##name = lros::LArray<item_type>(); \
+	} \
+
+#define L_FIELD_ARRAY(name, type) \
+	static_assert(lros::LTypeTrait<type>::kValue!=lros::l_void, "Invalid array item type, see LType list for supported std types!"); \
+	__L_FIELD_ARRAY(name, type) \
+
+#define L_FIELD_REF_ARRAY(name, ref_type) \
+	__L_FIELD_ARRAY(name, lros::LRef<ref_type>) \
+
 };
 
 #endif //LROS_ROS_H_
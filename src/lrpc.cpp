@@ -0,0 +1,199 @@
+#include "lrpc.h"
+
+namespace lros {
+
+// copy the len bytes of one call or reply from s into body, decoded from
+// there with refs of their own, the ref cache of s is left to its frame
+static bool rpc_read_body(LStream& s, LMemStream& body, size_t len)
+{
+	body.reset();
+	body.ref_cache().clear();
+	body.set_wire_format(s.wire_format());
+
+	// buffered sources hand over their bytes in one go
+	LBufferStream* buffered = dynamic_cast<LBufferStream*>(&s);
+	const lbyte* span = buffered ? buffered->read_span(len) : NULL;
+	if (span)
+	{
+		body.assign(span, len);
+		return true;
+	}
+
+	// streams that can not expose their bytes are copied in chunks
+	lbyte buf[256];
+	while (len > 0)
+	{
+		size_t n = len < sizeof(buf) ? len : sizeof(buf);
+		if (!s.read_bytes(buf, n))
+			return false;
+		body.write_bytes(buf, n);
+		len -= n;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LRpcClient
+LRpcClient::LRpcClient()
+	: m_queued(0), m_next_request(1)
+{
+}
+
+LRpcClient::~LRpcClient()
+{
+	cancel_all();
+}
+
+void LRpcClient::set_wire_format(LWireFormat format)
+{
+	assert(m_queued == 0 && "Set the wire format before the first call!");
+	m_batch.set_wire_format(format);
+	m_scratch.set_wire_format(format);
+}
+
+void LRpcClient::begin_call()
+{
+	m_scratch.reset();
+	m_scratch.ref_cache().clear_written();
+}
+
+void LRpcClient::end_call(int service_id, int method_id, const std::shared_ptr<LRpcState>& state, Completer complete)
+{
+	luint32 request_id = m_next_request++;
+	m_batch.write((lbyte)op_rpc);
+	m_batch.write_type_id(service_id);
+	m_batch.write_field_id(method_id);
+	m_batch.write((lint32)request_id);
+	m_batch.write_length(m_scratch.size());
+	m_batch.write_bytes(m_scratch.data(), m_scratch.size());
+	++m_queued;
+
+	Pending& pending = m_pending[request_id];
+	pending.state = state;
+	pending.complete = complete;
+}
+
+bool LRpcClient::flush(LStream& s)
+{
+	if (m_queued == 0)
+		return false;
+	s.write_bytes(m_batch.data(), m_batch.size());
+	s.write((lbyte)op_end);
+	m_batch.reset();
+	m_queued = 0;
+	return true;
+}
+
+bool LRpcClient::dispatch(LStream& s)
+{
+	for (;;)
+	{
+		lbyte op = op_end;
+		if (!s.read(op))
+			return false;
+		if (op == op_end)
+			return true;
+		if (op != op_rpc_reply)
+		{
+			std::cout << "RPC Error! Invalid op:" << (int)op << std::endl;
+			return false;
+		}
+
+		lint32 request_id = 0;
+		lbyte status = 0;
+		size_t len = 0;
+		if (!s.read(request_id) || !s.read(status) || !s.read_length(len)
+			|| !rpc_read_body(s, m_reply, len))
+			return false;
+
+		auto it = m_pending.find((luint32)request_id);
+		// no longer pending if it was cancelled
+		if (it != m_pending.end())
+		{
+			Pending pending = it->second;
+			m_pending.erase(it);
+			if (!pending.complete(pending.state, &m_reply, (LRpcStatus)status))
+				std::cout << "RPC Error! Bad result, request_id:" << request_id << std::endl;
+		}
+	}
+}
+
+void LRpcClient::cancel_all(LRpcStatus status)
+{
+	assert(status != kRpc_OK && status != kRpc_Pending);
+	m_batch.reset();
+	m_queued = 0;
+
+	// callbacks may issue new calls
+	std::unordered_map<luint32, Pending> pending;
+	pending.swap(m_pending);
+	for (auto& it : pending)
+		it.second.complete(it.second.state, NULL, status);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LRpcServer
+LRpcServer::LRpcServer()
+{
+}
+
+void LRpcServer::add_service(int service_id, LObject* service, const LRpcRegistry* registry)
+{
+	assert(service && registry);
+	Service& entry = m_services[service_id];
+	entry.object = service;
+	entry.registry = registry;
+}
+
+void LRpcServer::remove_service(int service_id)
+{
+	m_services.erase(service_id);
+}
+
+bool LRpcServer::dispatch(LStream& in, LStream& out)
+{
+	m_scratch.set_wire_format(out.wire_format());
+	for (;;)
+	{
+		lbyte op = op_end;
+		if (!in.read(op))
+			return false;
+		if (op == op_end)
+			break;
+		if (op != op_rpc)
+		{
+			std::cout << "RPC Error! Invalid op:" << (int)op << std::endl;
+			return false;
+		}
+
+		int service_id = 0, method_id = 0;
+		lint32 request_id = 0;
+		size_t len = 0;
+		if (!in.read_type_id(service_id) || !in.read_field_id(method_id) 
+			|| !in.read(request_id) || !in.read_length(len)
+			|| !rpc_read_body(in, m_args, len))
+			return false;
+
+		m_scratch.reset();
+		m_scratch.ref_cache().clear_written();
+		LRpcStatus status = kRpc_NoService;
+		auto sit = m_services.find(service_id);
+		if (sit != m_services.end())
+		{
+			const LRpcMethod* method = sit->second.registry->get_method(method_id);
+			status = method ? method->invoker(m_args, m_scratch, sit->second.object) : kRpc_NoMethod;
+		}
+		if (status != kRpc_OK)
+			m_scratch.reset();
+
+		out.write((lbyte)op_rpc_reply);
+		out.write(request_id);
+		out.write((lbyte)status);
+		out.write_length(m_scratch.size());
+		out.write_bytes(m_scratch.data(), m_scratch.size());
+	}
+	out.write((lbyte)op_end);
+	return true;
+}
+
+}//lros
@@ -0,0 +1,431 @@
+#ifndef LROS_RPC_H_
+#define LROS_RPC_H_
+
+#include "lobject.h"
+#include "lstream.h"
+#include "lreplica.h"
+
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+
+//
+// RPC Packet
+//	- packet	: # [op]... # op_end #
+//	- call		: # op_rpc # service_id # method_id # request_id # body_len # args #
+//	- reply		: # op_rpc_reply # request_id # status # body_len # result #
+//	- service_id is the class id of the service class, method_id the id
+//	  given to L_REGISTER_RPC, request_id is chosen by the caller
+//	- body_len lets a peer skip a call or reply it can not decode
+//	- refs in args and results are written whole, once per call, and read
+//	  from a copy of the body with a ref cache of its own
+//	- both peers must use the same wire format
+//
+
+namespace lros
+{
+
+static const int kMaxRpcMethodNum = 256;
+
+enum LRpcStatus
+{
+	kRpc_Pending	= -1,	// no reply yet
+	kRpc_OK			= 0,
+	kRpc_NoService	= 1,	// service_id not added to the server
+	kRpc_NoMethod	= 2,	// method_id not registered by the service class
+	kRpc_BadArgs	= 3,	// args or result did not decode
+	kRpc_Cancelled	= 4,	// see LRpcClient::cancel_all
+};
+
+// reads the args from in, runs the method of service, writes the result to out
+typedef LRpcStatus (*LRpcInvoker)(LStream& in, LStream& out, LObject* service);
+
+struct LRpcMethod
+{
+	LRpcMethod() : method_id(0), method_name(NULL), invoker(NULL) {}
+
+	int method_id;
+	const char* method_name;
+	LRpcInvoker invoker;
+};
+
+// methods of one service class, including the ones of its super classes
+struct LRpcRegistry
+{
+	std::vector<LRpcMethod> method_list;
+	// method id -> index in method_list, -1 if not registered
+	lint16 method_index[kMaxRpcMethodNum];
+
+	LRpcRegistry()
+	{
+		for (int i = 0; i < kMaxRpcMethodNum; ++i)
+			method_index[i] = -1;
+	}
+
+	inline void add_method(const LRpcMethod& method)
+	{
+		assert(method.method_id >= 0 && method.method_id < kMaxRpcMethodNum);
+		method_index[method.method_id] = (lint16)method_list.size();
+		method_list.push_back(method);
+	}
+
+	inline const LRpcMethod* get_method(int method_id) const
+	{
+		if ((unsigned)method_id >= (unsigned)kMaxRpcMethodNum)
+			return NULL;
+		int index = method_index[method_id];
+		return index < 0 ? NULL : &method_list[index];
+	}
+
+	// copy of the registry of S, empty if S has no L_RPC_LIST
+	template<typename S>
+	static LRpcRegistry inherit() { return inherit_impl<S>(0); }
+
+private:
+	template<typename S>
+	static auto inherit_impl(int) -> decltype(S::__rpc_registry(), LRpcRegistry()) { return S::__rpc_registry(); }
+	template<typename S>
+	static LRpcRegistry inherit_impl(...) { return LRpcRegistry(); }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// method signature traits, args are stored decayed: const lstring& -> lstring
+
+template<size_t... I>
+struct LRpcIndices {};
+
+template<size_t N, size_t... I>
+struct LRpcMakeIndices : LRpcMakeIndices<N - 1, N - 1, I...> {};
+
+template<size_t... I>
+struct LRpcMakeIndices<0, I...> { typedef LRpcIndices<I...> type; };
+
+struct LRpcVoid {};
+
+template<typename C, typename R, typename... A>
+struct LRpcSignature
+{
+	typedef C ClassType;
+	typedef R ResultType;
+	// value kept by the future
+	typedef typename std::conditional<std::is_void<R>::value,
+		LRpcVoid, typename std::decay<R>::type>::type ValueType;
+	typedef std::tuple<typename std::decay<A>::type...> ArgsType;
+	typedef typename LRpcMakeIndices<sizeof...(A)>::type IndicesType;
+	static const size_t kArgCount = sizeof...(A);
+};
+
+template<typename M>
+struct LRpcTraits;
+
+template<typename C, typename R, typename... A>
+struct LRpcTraits<R (C::*)(A...)> : LRpcSignature<C, R, A...> {};
+
+template<typename C, typename R, typename... A>
+struct LRpcTraits<R (C::*)(A...) const> : LRpcSignature<C, R, A...> {};
+
+// id of method F, set when the registry of its service class is built
+template<typename M, M F>
+struct LRpcMethodId
+{
+	static int& value() { static int s_method_id = -1; return s_method_id; }
+};
+
+// args of a call, written and read in declaration order
+struct LRpcArgs
+{
+	template<typename T, size_t... I>
+	static bool read(LStream& s, T& args, LRpcIndices<I...>)
+	{
+		bool ok = true;
+		int expand[] = { 0, (ok = ok && s.read(std::get<I>(args)), 0)... };
+		(void)expand;
+		return ok;
+	}
+
+	// each arg is converted to the declared type first
+	template<typename T, size_t N = 0>
+	static bool write(LStream& s) { (void)s; return true; }
+
+	template<typename T, size_t N = 0, typename A, typename... Rest>
+	static bool write(LStream& s, const A& arg, const Rest&... rest)
+	{
+		const typename std::tuple_element<N, T>::type& v = arg;
+		return s.write(v) && write<T, N + 1>(s, rest...);
+	}
+};
+
+template<typename R>
+struct LRpcResult
+{
+	template<typename C, typename M, M F, typename T, size_t... I>
+	static bool call(LStream& out, C* service, T& args, LRpcIndices<I...>)
+	{
+		const typename std::decay<R>::type& result = (service->*F)(std::get<I>(args)...);
+		return out.write(result);
+	}
+	template<typename V>
+	static bool read(LStream& in, V& v) { return in.read(v); }
+	static bool read(LStream& in, LRpcVoid& v) { (void)in; (void)v; return true; }
+};
+
+template<>
+struct LRpcResult<void>
+{
+	template<typename C, typename M, M F, typename T, size_t... I>
+	static bool call(LStream& out, C* service, T& args, LRpcIndices<I...>)
+	{
+		(void)out;
+		(service->*F)(std::get<I>(args)...);
+		return true;
+	}
+};
+
+// LRpcInvoker of method F, the method is a template argument and can be
+// inlined into the thunk
+template<typename M, M F>
+LRpcStatus rpc_invoke_thunk(LStream& in, LStream& out, LObject* service)
+{
+	typedef LRpcTraits<M> Traits;
+	typename Traits::ArgsType args;
+	if (!LRpcArgs::read(in, args, typename Traits::IndicesType()))
+		return kRpc_BadArgs;
+	typedef typename Traits::ClassType C;
+	if (!LRpcResult<typename Traits::ResultType>::template call<C, M, F>(
+		out, static_cast<C*>(service), args, typename Traits::IndicesType()))
+		return kRpc_BadArgs;
+	return kRpc_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// futures, completed by LRpcClient::dispatch() or cancel_all()
+
+struct LRpcState
+{
+	LRpcState() : status(kRpc_Pending) {}
+	virtual ~LRpcState() {}
+
+	LRpcStatus status;
+};
+
+//
+// LRpcFuture - result of one call
+//	- R is the decayed result type, LRpcVoid for void methods
+//	- is_ready() once the reply was dispatched, get() is valid if ok()
+//	- then() callbacks run inside LRpcClient::dispatch(), they may issue calls
+//
+template<typename R>
+class LRpcFuture
+{
+public:
+	typedef R ValueType;
+	typedef std::function<void(const LRpcFuture<R>&)> Callback;
+
+	LRpcFuture() {}
+
+	inline bool valid() const { return m_state != nullptr; }
+	inline bool is_ready() const { return m_state && m_state->status != kRpc_Pending; }
+	inline LRpcStatus status() const { return m_state ? m_state->status : kRpc_Cancelled; }
+	inline bool ok() const { return status() == kRpc_OK; }
+	inline const ValueType& get() const
+	{
+		assert(ok() && "RPC result is not ready, check ok() first!");
+		return m_state->value;
+	}
+
+	// cb runs once the call completes, now if it already has
+	void then(const Callback& cb)
+	{
+		assert(valid());
+		if (is_ready())
+			cb(*this);
+		else
+			m_state->callback = cb;
+	}
+
+private:
+	friend class LRpcClient;
+
+	struct State : public LRpcState
+	{
+		ValueType value;
+		Callback callback;
+	};
+
+	explicit LRpcFuture(const std::shared_ptr<State>& state) : m_state(state) {}
+
+	// read the result if status is kRpc_OK, then run the callback,
+	// false if the result did not decode
+	static bool complete(const std::shared_ptr<LRpcState>& base, LStream* in, LRpcStatus status)
+	{
+		std::shared_ptr<State> state = std::static_pointer_cast<State>(base);
+		if (status == kRpc_OK && !LRpcResult<R>::read(*in, state->value))
+			status = kRpc_BadArgs;
+		state->status = status;
+		if (state->callback)
+		{
+			Callback cb;
+			cb.swap(state->callback);
+			cb(LRpcFuture<R>(state));
+		}
+		return status != kRpc_BadArgs;
+	}
+
+	std::shared_ptr<State> m_state;
+};
+
+//
+// LRpcClient - caller side of one connection
+//	- call() only queues the call, flush() writes all calls issued since the
+//	  last flush as one packet, so the calls of a tick share one frame
+//	- any number of calls may be in flight, replies are matched by request id
+//	- dispatch() applies a reply packet and completes the futures
+//
+class LRpcClient
+{
+public:
+	LRpcClient();
+	~LRpcClient();
+
+	// queue a call of method F of service class S, see L_RPC:
+	//	client.call<L_RPC(MyService, add)>(1, 2)
+	template<typename S, typename M, M F, typename... A>
+	LRpcFuture<typename LRpcTraits<M>::ValueType> call(const A&... args)
+	{
+		typedef LRpcTraits<M> Traits;
+		typedef LRpcFuture<typename Traits::ValueType> Future;
+		static_assert(std::is_base_of<typename Traits::ClassType, S>::value, "RPC method must belong to the service class!");
+		static_assert(sizeof...(A) == Traits::kArgCount, "RPC argument count mismatch!");
+
+		// builds the registry of S once, which sets the method ids
+		S::__rpc_registry();
+		int method_id = LRpcMethodId<M, F>::value();
+		assert(method_id >= 0 && "RPC method is not registered, see L_REGISTER_RPC!");
+
+		begin_call();
+		LRpcArgs::write<typename Traits::ArgsType>(m_scratch, args...);
+		std::shared_ptr<typename Future::State> state = std::make_shared<typename Future::State>();
+		end_call(S::l_meta_class()->class_id(), method_id, state, &Future::complete);
+		return Future(state);
+	}
+
+	// write the queued calls into s as one packet, false if none were queued
+	bool flush(LStream& s);
+	// apply a reply packet, false if it is malformed
+	bool dispatch(LStream& s);
+	// complete every pending call with status, e.g. when the connection is lost
+	void cancel_all(LRpcStatus status = kRpc_Cancelled);
+
+	inline size_t queued_count() const { return m_queued; }
+	inline size_t pending_count() const { return m_pending.size(); }
+
+	// format of the packets written by flush(), must match the peer
+	inline LWireFormat wire_format() const { return m_batch.wire_format(); }
+	void set_wire_format(LWireFormat format);
+
+private:
+	LRpcClient(const LRpcClient&);
+	LRpcClient& operator=(const LRpcClient&);
+
+	typedef bool (*Completer)(const std::shared_ptr<LRpcState>&, LStream*, LRpcStatus);
+	struct Pending
+	{
+		std::shared_ptr<LRpcState> state;
+		Completer complete;
+	};
+
+	// args go to m_scratch, then end_call() appends the call to m_batch
+	void begin_call();
+	void end_call(int service_id, int method_id, const std::shared_ptr<LRpcState>& state, Completer complete);
+
+	LMemStream m_batch;			// calls queued since the last flush
+	LMemStream m_scratch;		// args of the call being issued
+	LMemStream m_reply;			// result of the reply being applied
+	size_t m_queued;
+	luint32 m_next_request;
+	std::unordered_map<luint32, Pending> m_pending;
+};
+
+//
+// LRpcServer - callee side, serves any number of connections
+//	- services are not owned, keep them alive until remove_service()
+//	- one service object per service class
+//
+class LRpcServer
+{
+public:
+	LRpcServer();
+
+	template<typename S>
+	inline void add_service(S* service)
+	{
+		add_service(S::l_meta_class()->class_id(), service, &S::__rpc_registry());
+	}
+	void add_service(int service_id, LObject* service, const LRpcRegistry* registry);
+	void remove_service(int service_id);
+
+	// run the calls of a packet in order, their replies go to out as one
+	// packet, false if in is malformed, out is not complete then
+	bool dispatch(LStream& in, LStream& out);
+
+	inline size_t service_count() const { return m_services.size(); }
+
+private:
+	LRpcServer(const LRpcServer&);
+	LRpcServer& operator=(const LRpcServer&);
+
+	struct Service
+	{
+		LObject* object;
+		const LRpcRegistry* registry;
+	};
+
+	std::unordered_map<int, Service> m_services;
+	LMemStream m_args;			// args of the call being run
+	LMemStream m_scratch;		// result of the call being run
+};
+
+}//lros
+
+//////////////////////////////////////////////////////////////////////////
+// RPC methods of a service class, public and not overloaded:
+//	L_RPC_LIST_BEGIN
+//	L_REGISTER_RPC(1, add)
+//	L_RPC_LIST_END
+//	- the methods of super classes are inherited
+//	- args and results are types LStream can read and write
+#define L_RPC_LIST_BEGIN \
+public: \
+	static const lros::LRpcRegistry& __rpc_registry() \
+	{ \
+		static const lros::LRpcRegistry s_registry = __build_rpc_registry(); \
+		return s_registry; \
+	} \
+	static lros::LRpcRegistry __build_rpc_registry() \
+	{ \
+		lros::LRpcRegistry registry = lros::LRpcRegistry::inherit<LSuperClassType>(); \
+
+#define L_RPC_LIST_END \
+		return registry; \
+	} \
+
+#define L_REGISTER_RPC(id, name) \
+{ \
+	static_assert(id >= 0 && id < lros::kMaxRpcMethodNum, "RPC method ID must < kMaxRpcMethodNum !"); \
+	typedef decltype(&LClassType::name) __LRpcMethodType; \
+	assert(registry.get_method(id) == NULL \
+		&& "RPC method id conflict, check if id is already used in this or super class!"); \
+	lros::LRpcMethod _method; \
+	_method.method_id = id; \
+	_method.method_name = #name; \
+	_method.invoker = &lros::rpc_invoke_thunk<__LRpcMethodType, &LClassType::name>; \
+	registry.add_method(_method); \
+	lros::LRpcMethodId<__LRpcMethodType, &LClassType::name>::value() = id; \
+} \
+
+// template arguments of LRpcClient::call() for method of class_name
+#define L_RPC(class_name, method) \
+	class_name, decltype(&class_name::method), &class_name::method \
+
+#endif //LROS_RPC_H_
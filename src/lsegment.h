@@ -0,0 +1,103 @@
+#ifndef LROS_SEGMENT_H_
+#define LROS_SEGMENT_H_
+
+#include "ldefines.h"
+
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace lros
+{
+
+//
+// LSegment - immutable encoded bytes, shared by reference
+//	- one allocation holds the count and the bytes
+//	- e.g. a replication packet encoded once and queued on the streams
+//	  of every slave, see LReplicaHost::flush_segment, LTcpStream::write_segment
+//	- the count is atomic, a segment may be released by any thread
+//
+class LSegment
+{
+public:
+	inline const lbyte* data() const { return reinterpret_cast<const lbyte*>(this + 1); }
+	inline size_t size() const { return m_size; }
+
+	// a copy of size bytes at data, with a count of 0
+	static LSegment* create(const lbyte* data, size_t size)
+	{
+		void* mem = ::operator new(sizeof(LSegment) + size);
+		LSegment* segment = new (mem) LSegment(size);
+		if (size > 0)
+			memcpy(mem_data(segment), data, size);
+		return segment;
+	}
+
+	inline void add_ref() { m_ref_count.fetch_add(1, std::memory_order_relaxed); }
+	inline void release()
+	{
+		if (m_ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			this->~LSegment();
+			::operator delete(this);
+		}
+	}
+
+private:
+	explicit LSegment(size_t size) : m_ref_count(0), m_size(size) {}
+	LSegment(const LSegment&);
+	LSegment& operator=(const LSegment&);
+
+	static inline lbyte* mem_data(LSegment* segment) { return reinterpret_cast<lbyte*>(segment + 1); }
+
+	std::atomic<int> m_ref_count;
+	size_t m_size;
+};
+
+// reference to an LSegment
+class LSegmentRef
+{
+public:
+	LSegmentRef() : m_segment(NULL) {}
+	explicit LSegmentRef(LSegment* segment) : m_segment(segment) { if (m_segment) m_segment->add_ref(); }
+	LSegmentRef(const LSegmentRef& other) : m_segment(other.m_segment) { if (m_segment) m_segment->add_ref(); }
+	LSegmentRef(LSegmentRef&& other) : m_segment(other.m_segment) { other.m_segment = NULL; }
+	~LSegmentRef() { reset(); }
+
+	LSegmentRef& operator=(const LSegmentRef& other)
+	{
+		LSegmentRef(other).swap(*this);
+		return *this;
+	}
+	LSegmentRef& operator=(LSegmentRef&& other)
+	{
+		LSegmentRef(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	// a segment holding a copy of size bytes at data
+	static inline LSegmentRef create(const lbyte* data, size_t size)
+	{
+		return LSegmentRef(LSegment::create(data, size));
+	}
+
+	inline LSegment* get() const { return m_segment; }
+	inline LSegment* operator->() const { return m_segment; }
+	inline const lbyte* data() const { return m_segment ? m_segment->data() : NULL; }
+	inline size_t size() const { return m_segment ? m_segment->size() : 0; }
+
+	inline void reset()
+	{
+		if (m_segment)
+			m_segment->release();
+		m_segment = NULL;
+	}
+	inline void swap(LSegmentRef& other) { std::swap(m_segment, other.m_segment); }
+
+private:
+	LSegment* m_segment;
+};
+
+}//lros
+
+#endif //LROS_SEGMENT_H_
@@ -0,0 +1,403 @@
+#include "lshm.h"
+
+#if !defined(__linux__)
+#error "lshm.cpp is built on futex and POSIX shared memory, Linux only"
+#endif
+
+#include <algorithm>
+#include <new>
+#include <thread>
+
+#include <climits>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace lros {
+
+const char LShmStream::kMagic[8] = { 'L', 'R', 'O', 'S', 'R', 'I', 'N', 'G' };
+
+// ring data starts here, the header is padded to it
+static const size_t kShmRingOffset = 256;
+static const size_t kShmAlign = 8;
+static const luint32 kShmWrap = 0xffffffff;
+
+static_assert(sizeof(LShmRingHeader) <= kShmRingOffset, "LShmRingHeader too large!");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+	"Shared memory ring needs lock-free atomics!");
+
+static inline luint64 shm_align(luint64 v)
+{
+	return (v + kShmAlign - 1) & ~(luint64)(kShmAlign - 1);
+}
+
+static inline void shm_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+// false on timeout
+static bool shm_futex_wait(std::atomic<luint32>* addr, luint32 value, int timeout_ms)
+{
+	timespec ts;
+	timespec* pts = NULL;
+	if (timeout_ms >= 0)
+	{
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+		pts = &ts;
+	}
+	// shared mapping, so not FUTEX_PRIVATE
+	long r = syscall(SYS_futex, (luint32*)addr, FUTEX_WAIT, value, pts, NULL, 0);
+	return r == 0 || errno != ETIMEDOUT;
+}
+
+static void shm_futex_wake(std::atomic<luint32>* addr)
+{
+	syscall(SYS_futex, (luint32*)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// wake the other side if it announced it sleeps, after publishing a position
+static inline void shm_notify(std::atomic<luint32>& waiting, std::atomic<luint32>& signal)
+{
+	// orders the position store before the waiting load, see shm_sleep
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	// cleared here, one wake per sleep instead of one per frame
+	if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0, std::memory_order_relaxed))
+	{
+		signal.fetch_add(1, std::memory_order_release);
+		shm_futex_wake(&signal);
+	}
+}
+
+// spin, then sleep until ready() or timeout_ms, ready() reads the other side's position
+template<typename F>
+static bool shm_sleep(std::atomic<luint32>& waiting, std::atomic<luint32>& signal, int timeout_ms, F ready)
+{
+	// the other side can not make progress while we spin on a single cpu
+	static const int s_spin = std::thread::hardware_concurrency() > 1 ? LShmStream::kSpinCount : 0;
+	for (int i = 0; i < s_spin; ++i)
+	{
+		if (ready())
+			return true;
+		shm_relax();
+	}
+	if (timeout_ms == 0)
+		return ready();
+
+	while (true)
+	{
+		luint32 seq = signal.load(std::memory_order_acquire);
+		waiting.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (ready())
+		{
+			waiting.store(0, std::memory_order_relaxed);
+			return true;
+		}
+		bool woken = shm_futex_wait(&signal, seq, timeout_ms);
+		waiting.store(0, std::memory_order_relaxed);
+		if (ready())
+			return true;
+		if (!woken)
+			return false;
+	}
+}
+
+LShmStream::LShmStream()
+	: m_header(NULL), m_ring(NULL), m_map_size(0), m_capacity(0), m_mask(0), m_producer(false),
+	m_frame_pos(0), m_tail_cache(0), m_write_timeout(1000), m_dropped(false), m_bytes_published(0),
+	m_read_pos(0), m_head_cache(0), m_frame_data(NULL), m_frame_open(false), m_bytes_consumed(0)
+{
+}
+
+LShmStream::~LShmStream()
+{
+	close();
+}
+
+size_t LShmStream::bytes_written() const
+{
+	if (!m_producer || !m_ring)
+		return m_bytes_published;
+	const lbyte* frame = m_ring + (m_frame_pos & m_mask) + sizeof(luint32);
+	return m_bytes_published + (size_t)(m_put_cur - frame);
+}
+
+size_t LShmStream::bytes_read() const
+{
+	if (!m_frame_open)
+		return m_bytes_consumed;
+	return m_bytes_consumed + (size_t)(m_get_cur - m_frame_data);
+}
+
+bool LShmStream::create(const char* name, size_t capacity)
+{
+	close();
+	size_t cap = 4096;
+	while (cap < capacity)
+		cap *= 2;
+
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, (off_t)(kShmRingOffset + cap)) != 0 || !map(fd, kShmRingOffset + cap))
+	{
+		::close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	::close(fd);
+
+	LShmRingHeader* h = new (m_header) LShmRingHeader();
+	h->version = kVersion;
+	h->capacity = cap;
+	h->head.store(0, std::memory_order_relaxed);
+	h->head_signal.store(0, std::memory_order_relaxed);
+	h->consumer_waiting.store(0, std::memory_order_relaxed);
+	h->tail.store(0, std::memory_order_relaxed);
+	h->tail_signal.store(0, std::memory_order_relaxed);
+	h->producer_waiting.store(0, std::memory_order_relaxed);
+	// magic last, open() checks it first
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(h->magic, kMagic, sizeof(kMagic));
+
+	m_name = name;
+	m_producer = true;
+	m_capacity = cap;
+	m_mask = cap - 1;
+	m_frame_pos = 0;
+	m_tail_cache = 0;
+	open_frame();
+	return true;
+}
+
+bool LShmStream::open(const char* name)
+{
+	close();
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size <= kShmRingOffset || !map(fd, (size_t)st.st_size))
+	{
+		::close(fd);
+		return false;
+	}
+	::close(fd);
+
+	const LShmRingHeader* h = m_header;
+	bool valid = memcmp(h->magic, kMagic, sizeof(kMagic)) == 0;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	luint64 cap = h->capacity;
+	valid = valid && h->version == kVersion
+		&& cap >= 4096 && (cap & (cap - 1)) == 0
+		&& kShmRingOffset + cap == m_map_size;
+	if (!valid)
+	{
+		std::cout << "Shm Error! Invalid ring:" << name << std::endl;
+		close();
+		return false;
+	}
+
+	m_producer = false;
+	m_capacity = (size_t)cap;
+	m_mask = cap - 1;
+	m_read_pos = h->tail.load(std::memory_order_acquire);
+	m_head_cache = m_read_pos;
+	return true;
+}
+
+void LShmStream::close()
+{
+	if (m_header)
+		munmap((void*)m_header, m_map_size);
+	if (m_producer && !m_name.empty())
+		shm_unlink(m_name.c_str());
+	m_header = NULL;
+	m_ring = NULL;
+	m_map_size = 0;
+	m_capacity = 0;
+	m_producer = false;
+	m_name.clear();
+	m_put_cur = m_put_end = NULL;
+	m_get_cur = m_get_end = NULL;
+	m_frame_open = false;
+	m_frame_data = NULL;
+	m_dropped = false;
+}
+
+bool LShmStream::map(int fd, size_t size)
+{
+	void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		return false;
+	m_header = (LShmRingHeader*)base;
+	m_ring = (lbyte*)base + kShmRingOffset;
+	m_map_size = size;
+	return true;
+}
+
+bool LShmStream::wait_room(luint64 end)
+{
+	if (end - m_tail_cache <= m_capacity)
+		return true;
+	LShmRingHeader* h = m_header;
+	luint64 cap = m_capacity;
+	luint64& tail = m_tail_cache;
+	return shm_sleep(h->producer_waiting, h->tail_signal, m_write_timeout, [h, cap, end, &tail]()
+	{
+		tail = h->tail.load(std::memory_order_acquire);
+		return end - tail <= cap;
+	});
+}
+
+bool LShmStream::wait(int timeout_ms)
+{
+	if (!m_header || m_producer)
+		return false;
+	if (m_head_cache != m_read_pos)
+		return true;
+	LShmRingHeader* h = m_header;
+	luint64 pos = m_read_pos;
+	luint64& head = m_head_cache;
+	return shm_sleep(h->consumer_waiting, h->head_signal, timeout_ms, [h, pos, &head]()
+	{
+		head = h->head.load(std::memory_order_acquire);
+		return head != pos;
+	});
+}
+
+void LShmStream::open_frame()
+{
+	luint64 off = m_frame_pos & m_mask;
+	luint64 room = std::min<luint64>(m_capacity - off, m_tail_cache + m_capacity - m_frame_pos);
+	m_put_cur = m_ring + off + sizeof(luint32);
+	m_put_end = room > sizeof(luint32) ? m_ring + off + room : m_put_cur;
+}
+
+bool LShmStream::reserve(size_t need)
+{
+	if (need > m_capacity / 2)
+		return false;
+	luint64 off = m_frame_pos & m_mask;
+	if (off + need > m_capacity)
+	{
+		// the frame moves to the ring start, a wrap marker takes its place
+		luint64 pos = m_frame_pos + (m_capacity - off);
+		if (!wait_room(pos + need))
+			return false;
+		size_t written = (size_t)(m_put_cur - (m_ring + off));
+		memmove(m_ring, m_ring + off, written);
+		memcpy(m_ring + off, &kShmWrap, sizeof(kShmWrap));
+		m_frame_pos = pos;
+		off = 0;
+		m_put_cur = m_ring + written;
+	}
+	else if (!wait_room(m_frame_pos + need))
+	{
+		return false;
+	}
+	luint64 room = std::min<luint64>(m_capacity - off, m_tail_cache + m_capacity - m_frame_pos);
+	m_put_end = m_ring + off + room;
+	return true;
+}
+
+bool LShmStream::grow(size_t len)
+{
+	if (!m_producer || !m_header || m_dropped)
+		return false;
+	const lbyte* frame = m_ring + (m_frame_pos & m_mask);
+	if (!reserve((size_t)(m_put_cur - frame) + len))
+	{
+		// the rest of the frame is not written, end_frame() drops it
+		m_dropped = true;
+		m_put_end = m_put_cur;
+		return false;
+	}
+	return true;
+}
+
+bool LShmStream::end_frame()
+{
+	// refs do not back reference across frames
+	ref_cache().clear_written();
+	if (!m_producer || !m_header)
+		return false;
+	lbyte* frame = m_ring + (m_frame_pos & m_mask);
+	size_t len = (size_t)(m_put_cur - frame) - sizeof(luint32);
+	if (m_dropped || len > max_frame_size())
+	{
+		std::cout << "Shm Error! Frame dropped, ring full or frame too large:" << m_name << std::endl;
+		m_dropped = false;
+		open_frame();
+		return false;
+	}
+	if (len == 0)
+		return true;
+
+	luint32 n = (luint32)len;
+	memcpy(frame, &n, sizeof(n));
+	m_frame_pos += shm_align(sizeof(luint32) + len);
+	m_bytes_published += len;
+	m_header->head.store(m_frame_pos, std::memory_order_release);
+	shm_notify(m_header->consumer_waiting, m_header->head_signal);
+	open_frame();
+	return true;
+}
+
+bool LShmStream::next_frame()
+{
+	ref_cache().clear();
+	if (!m_header || m_producer)
+		return false;
+	if (m_frame_open)
+	{
+		m_bytes_consumed += (size_t)(m_get_end - m_frame_data);
+		m_frame_open = false;
+		m_header->tail.store(m_read_pos, std::memory_order_release);
+		shm_notify(m_header->producer_waiting, m_header->tail_signal);
+	}
+	m_get_cur = m_get_end = NULL;
+
+	while (true)
+	{
+		if (m_head_cache == m_read_pos)
+		{
+			m_head_cache = m_header->head.load(std::memory_order_acquire);
+			if (m_head_cache == m_read_pos)
+				return false;
+		}
+
+		luint64 off = m_read_pos & m_mask;
+		luint32 len = 0;
+		memcpy(&len, m_ring + off, sizeof(len));
+		if (len == kShmWrap)
+		{
+			m_read_pos += m_capacity - off;
+			continue;
+		}
+		if (len > max_frame_size() || off + sizeof(luint32) + len > m_capacity)
+		{
+			std::cout << "Shm Error! Invalid frame length:" << len << std::endl;
+			return false;
+		}
+
+		m_frame_data = m_ring + off + sizeof(luint32);
+		m_get_cur = m_frame_data;
+		m_get_end = m_frame_data + len;
+		m_read_pos += shm_align(sizeof(luint32) + len);
+		m_frame_open = true;
+		return true;
+	}
+}
+
+}//lros
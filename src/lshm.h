@@ -0,0 +1,128 @@
+#ifndef LROS_SHM_H_
+#define LROS_SHM_H_
+
+#include "lobject.h"
+#include "lstream.h"
+
+//
+// Shared Memory Ring, one producer and one consumer process
+//	- region	: # LShmRingHeader # ring[capacity] #
+//	- frame		: # luint32 length # payload # padding to 8 #
+//	- a frame never wraps, kShmWrap in the length skips to the ring start
+//	- head and tail only grow, ring offset is pos & (capacity - 1)
+//	- a side that found nothing to do spins briefly, then sleeps on a
+//	  futex in the region, the other side only wakes it if it sleeps
+//	- Linux only, lshm.cpp is left out of other builds
+//
+
+namespace lros
+{
+
+struct LShmRingHeader
+{
+	char magic[8];
+	luint32 version;
+	luint32 reserved;
+	luint64 capacity;
+
+	// written by the producer
+	alignas(64) std::atomic<luint64> head;		// end of published frames
+	std::atomic<luint32> head_signal;			// futex, bumped to wake the consumer
+	std::atomic<luint32> consumer_waiting;
+
+	// written by the consumer
+	alignas(64) std::atomic<luint64> tail;		// end of consumed frames
+	std::atomic<luint32> tail_signal;			// futex, bumped to wake the producer
+	std::atomic<luint32> producer_waiting;
+};
+
+//
+// LShmStream - LStream over one direction of a shared memory ring
+//	- producer: create() the ring, write the payload, end_frame() publishes it,
+//	  writes wait for space up to write_timeout, a frame that did not fit is dropped
+//	- consumer: open() the ring, next_frame() opens the next frame for reading
+//	  in place in the mapping, it is released by the next next_frame()
+//	- a host and a slave that talk both ways use two rings
+//	- the ref cache is scoped to one frame on both sides
+//
+class LShmStream : public LBufferStream
+{
+public:
+	static const luint32 kVersion = 1;
+	static const char kMagic[8];
+	static const size_t kDefaultCapacity = 4 * 1024 * 1024;
+	// polls before a side goes to sleep on the futex, a few microseconds
+	static const int kSpinCount = 128;
+
+	LShmStream();
+	~LShmStream();
+
+	// producer, creates or replaces the shared memory object name,
+	// capacity is rounded up to a power of two
+	bool create(const char* name, size_t capacity = kDefaultCapacity);
+	// consumer, maps a ring created by another process
+	bool open(const char* name);
+	// the creator also removes the name
+	void close();
+
+	inline bool is_open() const { return m_header != NULL; }
+	inline bool is_producer() const { return m_producer; }
+	inline size_t capacity() const { return m_capacity; }
+	// frames larger than this never fit
+	inline size_t max_frame_size() const { return m_capacity / 2 - sizeof(luint32); }
+
+	// producer: publish the frame written since the last end_frame(),
+	// an empty frame is not sent, false if it was dropped
+	bool end_frame();
+	// ms a write waits for the consumer to make room, -1 forever
+	inline void set_write_timeout(int ms) { m_write_timeout = ms; }
+
+	// consumer: true if a frame is open for reading, releases the previous one
+	bool next_frame();
+	// consumer: true once a frame is ready, false after timeout_ms (-1 forever)
+	bool wait(int timeout_ms);
+	inline size_t frame_size() const { return m_frame_open ? (size_t)(m_get_end - m_frame_data) : 0; }
+
+	virtual size_t bytes_written() const;
+	virtual size_t bytes_read() const;
+
+private:
+	LShmStream(const LShmStream&);
+	LShmStream& operator=(const LShmStream&);
+
+	virtual bool grow(size_t len);
+
+	bool map(int fd, size_t size);
+	// producer: make need bytes from the frame start writable, may move the frame to the ring start
+	bool reserve(size_t need);
+	// producer: wait until the ring has room up to end
+	bool wait_room(luint64 end);
+	// producer: put window of the frame at m_frame_pos, without waiting
+	void open_frame();
+
+	LShmRingHeader* m_header;
+	lbyte* m_ring;
+	size_t m_map_size;
+	size_t m_capacity;
+	luint64 m_mask;
+	bool m_producer;
+	std::string m_name;
+
+	// producer
+	luint64 m_frame_pos;		// header of the frame being written
+	luint64 m_tail_cache;		// last tail seen
+	int m_write_timeout;
+	bool m_dropped;				// a write of this frame failed
+	size_t m_bytes_published;
+
+	// consumer
+	luint64 m_read_pos;			// next frame to read
+	luint64 m_head_cache;		// last head seen
+	const lbyte* m_frame_data;	// payload of the open frame
+	bool m_frame_open;
+	size_t m_bytes_consumed;
+};
+
+}//lros
+
+#endif //LROS_SHM_H_
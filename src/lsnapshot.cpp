@@ -0,0 +1,441 @@
+#include "lsnapshot.h"
+#include "lworkpool.h"
+
+#include <algorithm>
+#include <fstream>
+
+#if defined(_WIN32)
+#error "lsnapshot.cpp maps files with mmap, POSIX only"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lros {
+
+const char LSnapshot::kMagic[8] = { 'L', 'R', 'O', 'S', 'S', 'N', 'A', 'P' };
+
+static const luint64 kSnapshotAlign = 8;
+// objects per work item, enough to amortize the pool overhead
+static const size_t kWriteGrain = 64;
+static const size_t kLoadGrain = 256;
+
+static inline luint64 align_up(luint64 v)
+{
+	return (v + kSnapshotAlign - 1) / kSnapshotAlign * kSnapshotAlign;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LSnapshotWriter
+LSnapshotWriter::LSnapshotWriter(LWireFormat format)
+	: m_wire_format(format)
+{
+}
+
+void LSnapshotWriter::add_root(LObject* obj)
+{
+	m_roots.push_back(LRef<LObject>(obj));
+}
+
+void LSnapshotWriter::visit(LObject* obj, std::vector<LObject*>& level)
+{
+	if (m_visited.insert(obj->l_ref_id()).second)
+		level.push_back(obj);
+}
+
+bool LSnapshotWriter::write(const char* path, LWorkPool* pool)
+{
+	std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	LSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	out.write((const char*)&header, sizeof(header));
+	luint64 pos = sizeof(header);
+
+	LWorkPool local(1);
+	if (!pool)
+		pool = &local;
+	std::vector<std::unique_ptr<Chunk> > chunks(pool->thread_count());
+	for (auto& chunk : chunks)
+	{
+		chunk.reset(new Chunk());
+		chunk->buffer.set_wire_format(m_wire_format);
+		chunk->buffer.set_ref_linker(chunk.get());
+	}
+
+	m_entries.clear();
+	m_visited.clear();
+	std::vector<LObject*> level, next;
+	for (const auto& root : m_roots)
+	{
+		if (root.get())
+			visit(root.get(), level);
+	}
+
+	// objects are only read here, so workers share them without locking
+	auto serialize = [&](size_t begin, size_t end, size_t worker)
+	{
+		Chunk& chunk = *chunks[worker];
+		for (size_t i = begin; i < end; ++i)
+		{
+			LObject* obj = level[i];
+			const LClass* cls = obj->l_class();
+			size_t start = chunk.buffer.size();
+			cls->serializer()(chunk.buffer, obj);
+
+			LSnapshotEntry e;
+			e.ref_id = obj->l_ref_id();
+			e.class_id = cls->class_id();
+			e.offset = start;
+			e.size = chunk.buffer.size() - start;
+			chunk.entries.push_back(e);
+		}
+	};
+
+	while (!level.empty())
+	{
+		pool->parallel_for(level.size(), kWriteGrain, serialize);
+
+		// append the chunks, queue the next level in worker order
+		next.clear();
+		for (auto& chunk : chunks)
+		{
+			for (auto& e : chunk->entries)
+			{
+				e.offset += pos;
+				m_entries.push_back(e);
+			}
+			out.write(chunk->buffer.data(), chunk->buffer.size());
+			pos += chunk->buffer.size();
+			for (LObject* obj : chunk->found)
+				visit(obj, next);
+
+			chunk->buffer.reset();
+			chunk->entries.clear();
+			chunk->found.clear();
+		}
+		level.swap(next);
+	}
+
+	static const char s_padding[kSnapshotAlign] = { 0 };
+	luint64 aligned = align_up(pos);
+	out.write(s_padding, aligned - pos);
+	pos = aligned;
+
+	std::sort(m_entries.begin(), m_entries.end(),
+		[](const LSnapshotEntry& a, const LSnapshotEntry& b) { return a.ref_id < b.ref_id; });
+	header.index_offset = pos;
+	out.write((const char*)m_entries.data(), m_entries.size() * sizeof(LSnapshotEntry));
+	pos += m_entries.size() * sizeof(LSnapshotEntry);
+
+	std::vector<luint32> class_index(m_entries.size());
+	for (size_t i = 0; i < class_index.size(); ++i)
+		class_index[i] = (luint32)i;
+	std::stable_sort(class_index.begin(), class_index.end(), [this](luint32 a, luint32 b)
+		{ return m_entries[a].class_id < m_entries[b].class_id; });
+	header.class_index_offset = pos;
+	out.write((const char*)class_index.data(), class_index.size() * sizeof(luint32));
+	pos += class_index.size() * sizeof(luint32);
+
+	aligned = align_up(pos);
+	out.write(s_padding, aligned - pos);
+	pos = aligned;
+
+	header.roots_offset = pos;
+	for (const auto& root : m_roots)
+	{
+		lint32 ref_id = root.ref_id();
+		out.write((const char*)&ref_id, sizeof(ref_id));
+		pos += sizeof(ref_id);
+	}
+
+	memcpy(header.magic, LSnapshot::kMagic, sizeof(header.magic));
+	header.version = LSnapshot::kVersion;
+	header.wire_format = m_wire_format;
+	header.object_count = m_entries.size();
+	header.root_count = m_roots.size();
+	header.file_size = pos;
+	out.seekp(0);
+	out.write((const char*)&header, sizeof(header));
+	out.flush();
+	return out.good();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LSnapshot
+LSnapshot::LSnapshot()
+	: m_base(NULL), m_size(0), m_header(NULL), m_entries(NULL), m_class_index(NULL), m_roots(NULL)
+{
+}
+
+LSnapshot::~LSnapshot()
+{
+	close();
+}
+
+bool LSnapshot::open(const char* path)
+{
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LSnapshotHeader))
+	{
+		::close(fd);
+		return false;
+	}
+	void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (base == MAP_FAILED)
+		return false;
+	// objects are touched in no particular order
+	madvise(base, (size_t)st.st_size, MADV_RANDOM);
+	m_base = (const lbyte*)base;
+	m_size = (size_t)st.st_size;
+
+	const LSnapshotHeader* h = (const LSnapshotHeader*)m_base;
+	const luint64 size = m_size;
+	bool valid = memcmp(h->magic, kMagic, sizeof(kMagic)) == 0
+		&& h->version == kVersion
+		&& (h->wire_format == kWire_Fixed || h->wire_format == kWire_Compact)
+		&& h->file_size == size
+		&& h->object_count <= size / sizeof(LSnapshotEntry)
+		&& h->root_count <= size / sizeof(lint32)
+		&& h->index_offset % kSnapshotAlign == 0
+		&& h->roots_offset % kSnapshotAlign == 0
+		&& h->index_offset >= sizeof(LSnapshotHeader)
+		&& h->index_offset + h->object_count * sizeof(LSnapshotEntry) == h->class_index_offset
+		&& h->class_index_offset + h->object_count * sizeof(luint32) <= h->roots_offset
+		&& h->roots_offset + h->root_count * sizeof(lint32) <= size;
+	if (!valid)
+	{
+		std::cout << "Snapshot Error! Invalid header:" << path << std::endl;
+		close();
+		return false;
+	}
+
+	m_header = h;
+	m_entries = (const LSnapshotEntry*)(m_base + h->index_offset);
+	m_class_index = (const luint32*)(m_base + h->class_index_offset);
+	m_roots = (const lint32*)(m_base + h->roots_offset);
+	m_scratch.set_wire_format((LWireFormat)h->wire_format);
+	return true;
+}
+
+void LSnapshot::close()
+{
+	m_loaded.clear();
+	m_all.clear();
+	m_pending.clear();
+	if (m_base)
+		munmap((void*)m_base, m_size);
+	m_base = NULL;
+	m_size = 0;
+	m_header = NULL;
+	m_entries = NULL;
+	m_class_index = NULL;
+	m_roots = NULL;
+}
+
+LRef<LObject> LSnapshot::root(size_t index)
+{
+	if (index >= root_count())
+		return LRef<LObject>();
+	return get(m_roots[index]);
+}
+
+LRef<LObject> LSnapshot::get(int ref_id)
+{
+	if (!m_all.empty())
+	{
+		const LSnapshotEntry* e = find_entry(ref_id);
+		return e ? m_all[e - m_entries] : LRef<LObject>();
+	}
+
+	auto it = m_loaded.find(ref_id);
+	if (it != m_loaded.end())
+		return it->second;
+
+	LRef<LObject> obj(create(ref_id));
+	if (!obj.get())
+		return obj;
+	if (!load_pending())
+		std::cout << "Snapshot Error! Failed to load ref_id:" << ref_id << std::endl;
+	return obj;
+}
+
+int LSnapshot::class_of(int ref_id) const
+{
+	const LSnapshotEntry* e = find_entry(ref_id);
+	return e ? e->class_id : 0;
+}
+
+size_t LSnapshot::class_ref_ids(int class_id, std::vector<int>& ref_ids) const
+{
+	ref_ids.clear();
+	if (!m_header)
+		return 0;
+	const luint32* begin = m_class_index;
+	const luint32* end = m_class_index + m_header->object_count;
+	const LSnapshotEntry* entries = m_entries;
+	const luint32* it = std::lower_bound(begin, end, class_id,
+		[entries](luint32 pos, int id) { return entries[pos].class_id < id; });
+	for (; it != end && entries[*it].class_id == class_id; ++it)
+		ref_ids.push_back(entries[*it].ref_id);
+	return ref_ids.size();
+}
+
+void LSnapshot::link(LObject* obj)
+{
+	(void)obj;
+	assert(0 && "LSnapshot is read only!");
+}
+
+// read only once load_all() filled m_all, workers share it
+LObject* LSnapshot::resolve(int ref_id)
+{
+	if (!m_all.empty())
+	{
+		const LSnapshotEntry* e = find_entry(ref_id);
+		return e ? m_all[e - m_entries].get() : NULL;
+	}
+
+	auto it = m_loaded.find(ref_id);
+	if (it != m_loaded.end())
+		return it->second.get();
+	return create(ref_id);
+}
+
+const LSnapshotEntry* LSnapshot::find_entry(int ref_id) const
+{
+	if (!m_header)
+		return NULL;
+	const LSnapshotEntry* begin = m_entries;
+	const LSnapshotEntry* end = m_entries + m_header->object_count;
+	const LSnapshotEntry* it = std::lower_bound(begin, end, ref_id,
+		[](const LSnapshotEntry& e, int id) { return e.ref_id < id; });
+	return it != end && it->ref_id == ref_id ? it : NULL;
+}
+
+bool LSnapshot::valid_record(const LSnapshotEntry* e) const
+{
+	if (e->offset < sizeof(LSnapshotHeader) || e->size > m_header->index_offset
+		|| e->offset > m_header->index_offset - e->size)
+	{
+		std::cout << "Snapshot Error! Invalid record, ref_id:" << e->ref_id << std::endl;
+		return false;
+	}
+	return true;
+}
+
+LObject* LSnapshot::create(int ref_id)
+{
+	const LSnapshotEntry* e = find_entry(ref_id);
+	if (!e || !valid_record(e))
+		return NULL;
+
+	LObject* obj = LClass::create_object(e->class_id);
+	if (!obj)
+		return NULL;
+	// registered before its fields are read, so cycles resolve to it
+	m_loaded[ref_id] = LRef<LObject>(obj);
+	m_pending.push_back(ref_id);
+	return obj;
+}
+
+// iterative, a long chain of refs does not recurse
+bool LSnapshot::load_pending()
+{
+	bool ok = true;
+	m_scratch.set_ref_linker(this);
+	while (!m_pending.empty())
+	{
+		int ref_id = m_pending.back();
+		m_pending.pop_back();
+
+		const LSnapshotEntry* e = find_entry(ref_id);
+		LObject* obj = m_loaded[ref_id].get();
+		m_scratch.assign(m_base + e->offset, (size_t)e->size);
+		if (!obj->l_class()->deserializer()(m_scratch, obj))
+			ok = false;
+		obj->l_clear_dirty();
+	}
+	m_scratch.set_ref_linker(NULL);
+	return ok;
+}
+
+bool LSnapshot::load_all(LWorkPool* pool)
+{
+	if (!m_header)
+		return false;
+	if (!m_all.empty())
+		return true;
+
+	LWorkPool local(1);
+	if (!pool)
+		pool = &local;
+	const size_t count = object_count();
+	std::atomic<bool> ok(true);
+
+	// create every object first, so any record can resolve its refs,
+	// objects loaded before keep their state and are not read again
+	m_all.resize(count);
+	std::vector<lbyte> fresh(count, 0);
+	pool->parallel_for(count, kLoadGrain, [&](size_t begin, size_t end, size_t)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const LSnapshotEntry* e = m_entries + i;
+			auto it = m_loaded.find(e->ref_id);
+			if (it != m_loaded.end())
+			{
+				m_all[i] = it->second;
+				continue;
+			}
+			LObject* obj = valid_record(e) ? LClass::create_object(e->class_id) : NULL;
+			if (!obj)
+			{
+				ok = false;
+				continue;
+			}
+			m_all[i] = LRef<LObject>(obj);
+			fresh[i] = 1;
+		}
+	});
+	m_loaded.clear();
+
+	std::vector<std::unique_ptr<LMemStream> > streams(pool->thread_count());
+	for (auto& stream : streams)
+	{
+		stream.reset(new LMemStream());
+		stream->set_wire_format((LWireFormat)m_header->wire_format);
+		stream->set_ref_linker(this);
+	}
+	pool->parallel_for(count, kLoadGrain, [&](size_t begin, size_t end, size_t worker)
+	{
+		LMemStream& s = *streams[worker];
+		for (size_t i = begin; i < end; ++i)
+		{
+			LObject* obj = m_all[i].get();
+			if (!fresh[i] || !obj)
+				continue;
+			const LSnapshotEntry* e = m_entries + i;
+			s.assign(m_base + e->offset, (size_t)e->size);
+			if (!obj->l_class()->deserializer()(s, obj))
+				ok = false;
+			obj->l_clear_dirty();
+		}
+	});
+
+	if (!ok)
+		std::cout << "Snapshot Error! Failed to load all objects" << std::endl;
+	return ok;
+}
+
+}//lros
@@ -0,0 +1,170 @@
+#ifndef LROS_SNAPSHOT_H_
+#define LROS_SNAPSHOT_H_
+
+#include "lobject.h"
+#include "lstream.h"
+
+#include <memory>
+#include <unordered_set>
+
+//
+// Snapshot File, native byte order
+//	- file		: # header # object records... # index # class index # roots #
+//	- record	: field list written by l_serialize, refs are ref ids only
+//	- index		: LSnapshotEntry[object_count], sorted by ref_id
+//	- class index	: luint32[object_count], index positions sorted by class_id, ref_id
+//	- roots		: lint32[root_count], ref ids
+//	- ref ids are the ids of the writing process, only used as keys in the file
+//	- records are in no particular order, the index locates them
+//	- POSIX only, the file is mapped with mmap
+//
+
+namespace lros
+{
+
+class LWorkPool;
+
+struct LSnapshotHeader
+{
+	char magic[8];
+	luint32 version;
+	luint32 wire_format;
+	luint64 object_count;
+	luint64 root_count;
+	luint64 index_offset;
+	luint64 class_index_offset;
+	luint64 roots_offset;
+	luint64 file_size;
+};
+
+struct LSnapshotEntry
+{
+	lint32 ref_id;
+	lint32 class_id;
+	luint64 offset;
+	luint64 size;
+};
+
+//
+// LSnapshotWriter - writes every object reachable from the roots once
+//	- objects must stay alive and unchanged during write()
+//	- breadth first, one level of the graph at a time, the objects of a
+//	  level are serialized by the pool into per worker buffers which are
+//	  then appended to the file
+//
+class LSnapshotWriter
+{
+public:
+	LSnapshotWriter(LWireFormat format = kWire_Compact);
+
+	template<typename T, typename P>
+	inline void add_root(const LRef<T, P>& root) { add_root(root.get()); }
+	void add_root(LObject* obj);
+
+	// false on io error, pool NULL serializes on the calling thread
+	bool write(const char* path, LWorkPool* pool = NULL);
+
+	// objects written by the last write()
+	inline size_t object_count() const { return m_entries.size(); }
+
+private:
+	LSnapshotWriter(const LSnapshotWriter&);
+	LSnapshotWriter& operator=(const LSnapshotWriter&);
+
+	// records of one worker, refs found while serializing go to found
+	struct Chunk : public LRefLinker
+	{
+		virtual void link(LObject* obj) { found.push_back(obj); }
+		virtual LObject* resolve(int) { return NULL; }
+
+		LMemStream buffer;
+		std::vector<LObject*> found;
+		std::vector<LSnapshotEntry> entries;	// offsets into buffer
+	};
+
+	// queue obj for the next level if not seen yet
+	void visit(LObject* obj, std::vector<LObject*>& level);
+
+	LWireFormat m_wire_format;
+	std::vector<LRef<LObject> > m_roots;
+	std::unordered_set<int> m_visited;
+	std::vector<LSnapshotEntry> m_entries;
+};
+
+//
+// LSnapshot - memory mapped snapshot, objects are created on first access
+//	- open() maps the file and checks the header, nothing is deserialized
+//	- get()/root() materialize the object through LClass::create_object,
+//	  with the objects reachable from it, since LRef fields need them
+//	- untouched objects cost no memory besides the mapping
+//	- load_all() materializes everything, chunks of the index are
+//	  decoded by the pool in parallel
+//
+class LSnapshot : private LRefLinker
+{
+public:
+	static const luint32 kVersion = 1;
+	static const char kMagic[8];
+
+	LSnapshot();
+	~LSnapshot();
+
+	bool open(const char* path);
+	// releases the objects held by the snapshot, refs held elsewhere stay valid
+	void close();
+
+	inline bool is_open() const { return m_header != NULL; }
+	inline size_t object_count() const { return m_header ? (size_t)m_header->object_count : 0; }
+	inline size_t root_count() const { return m_header ? (size_t)m_header->root_count : 0; }
+	inline size_t loaded_count() const { return m_all.empty() ? m_loaded.size() : m_all.size(); }
+
+	// create and read every object, pool NULL loads on the calling thread
+	bool load_all(LWorkPool* pool = NULL);
+
+	LRef<LObject> root(size_t index);
+	// NULL ref if ref_id is not in the snapshot
+	LRef<LObject> get(int ref_id);
+	template<typename T>
+	LRef<T> get(int ref_id)
+	{
+		LRef<LObject> obj = get(ref_id);
+		if (!obj.get() || !obj->l_instance_of(T::l_meta_class()))
+			return LRef<T>();
+		return LRef<T>(static_cast<T*>(obj.get()));
+	}
+
+	bool contains(int ref_id) const { return find_entry(ref_id) != NULL; }
+	// class id of ref_id, 0 if not in the snapshot
+	int class_of(int ref_id) const;
+	// ref ids of objects of exactly class_id, nothing is materialized
+	size_t class_ref_ids(int class_id, std::vector<int>& ref_ids) const;
+
+private:
+	LSnapshot(const LSnapshot&);
+	LSnapshot& operator=(const LSnapshot&);
+
+	virtual void link(LObject* obj);
+	virtual LObject* resolve(int ref_id);
+
+	const LSnapshotEntry* find_entry(int ref_id) const;
+	bool valid_record(const LSnapshotEntry* e) const;
+	// create the object, fields are read by load_pending()
+	LObject* create(int ref_id);
+	bool load_pending();
+
+	const lbyte* m_base;
+	size_t m_size;
+	const LSnapshotHeader* m_header;
+	const LSnapshotEntry* m_entries;
+	const luint32* m_class_index;
+	const lint32* m_roots;
+
+	std::unordered_map<int, LRef<LObject> > m_loaded;
+	std::vector<LRef<LObject> > m_all;		// by index position, after load_all()
+	std::vector<int> m_pending;
+	LMemStream m_scratch;
+};
+
+}//lros
+
+#endif //LROS_SNAPSHOT_H_
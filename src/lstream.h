@@ -1,3 +1,6 @@
+// outside the guard: lobject.h includes this file once LObject is complete
+#include "lobject.h"
+
 #ifndef LROS_STREAM_H_
 #define LROS_STREAM_H_
 
@@ -5,10 +8,82 @@
 
 #include <sstream>
 #include <fstream>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace lros
 {
 
+//
+// LRefCache - identity table of LRef objects for one stream
+//	- write side: ref ids already written in the current message, 
+//	  later occurrences are written as back references (-ref_id)
+//	- read side: wire ref id -> object, keeps a reference until cleared,
+//	  shared and cyclic refs resolve to one object
+//	- scoped to one packet or frame, long lived streams clear it per frame
+//	  and LReplicaSlave per packet, or it keeps dead objects alive
+//
+class LRefCache
+{
+public:
+	LRefCache() {}
+	~LRefCache() { clear(); }
+
+	// true if ref_id was not written before
+	inline bool mark_written(int ref_id) { return m_written.insert(ref_id).second; }
+	// start a new message on the write side
+	inline void clear_written() { m_written.clear(); }
+
+	inline LObject* find(int ref_id) const
+	{
+		auto oit = m_objects.find(ref_id);
+		return oit == m_objects.end() ? NULL : oit->second;
+	}
+
+	inline void insert(int ref_id, LObject* object)
+	{
+		assert(object && !find(ref_id));
+		object->l_add_ref<LRefCountAtomic>();
+		m_objects[ref_id] = object;
+	}
+
+	// release all cached objects
+	void clear()
+	{
+		m_written.clear();
+		for (auto& it : m_objects)
+		{
+			if (it.second->l_release<LRefCountAtomic>() == 0)
+				delete it.second;
+		}
+		m_objects.clear();
+	}
+
+	inline size_t size() const { return m_objects.size(); }
+
+private:
+	LRefCache(const LRefCache&);
+	LRefCache& operator=(const LRefCache&);
+
+	std::unordered_set<int> m_written;
+	std::unordered_map<int, LObject*> m_objects;
+};
+
+//
+// LRefLinker - refs are written as ids only, the objects are stored elsewhere
+//	- write side: link() is called for every non-null ref written
+//	- read side: resolve() returns the object of a ref id, NULL if unknown
+//	- see LSnapshot
+//
+class LRefLinker
+{
+public:
+	virtual ~LRefLinker() {}
+	virtual void link(LObject* obj) = 0;
+	virtual LObject* resolve(int ref_id) = 0;
+};
+
 class LStream
 {
 public:
@@ -46,69 +121,347 @@ public:
 	virtual bool read_string(lstring& v) = 0;
 	virtual bool read_bytes(lbyte* buf, size_t len) = 0;
 
+	// read a string without copying it, v points into the stream buffer and
+	// stays valid until the stream is written to, reset or destroyed.
+	// only memory-backed streams support it, others return false
+	virtual bool read_string_view(LStringView& v) { (void)v; return false; }
+
+	// bytes written to and consumed from the stream so far, for tracing
+	virtual size_t bytes_written() const { return 0; }
+	virtual size_t bytes_read() const { return 0; }
+
 	//////////////////////////////////////////////////////////////////////////
-	template<typename T> inline bool write(const T& v);
-	template<typename T> inline bool read(T& v);
-
-	template<> inline bool write(const lbool& v) { return write_bool(v); }
-	template<> inline bool write(const lbyte& v) { return write_byte(v); }
-	template<> inline bool write(const lint16& v) { return write_int16(v); }
-	template<> inline bool write(const lint32& v) { return write_int32(v); }
-	template<> inline bool write(const lint64& v) { return write_int64(v); }
-	template<> inline bool write(const lfloat& v) { return write_float(v); }
-	template<> inline bool write(const ldouble& v) { return write_double(v); }
-	template<> inline bool write(const lstring& v) { return write_string(v); }
-	template<> inline bool write(const LObject& v) { return write_object(&v); }
-
-	template<> inline bool read(lbool& v) { return read_bool(v); }
-	template<> inline bool read(lbyte& v) { return read_byte(v); }
-	template<> inline bool read(lint16& v) { return read_int16(v); }
-	template<> inline bool read(lint32& v) { return read_int32(v); }
-	template<> inline bool read(lint64& v) { return read_int64(v); }
-	template<> inline bool read(lfloat& v) { return read_float(v); }
-	template<> inline bool read(ldouble& v) { return read_double(v); }
-	template<> inline bool read(lstring& v) { return read_string(v); }
-	template<> inline bool read(LObject& v) { return read_object(&v); }
+	// typed access, memory-backed streams take the inlined fast path
+	inline bool write(const lbool& v) { lbyte b = v ? 1 : 0; return fast_write(b) || write_bool(v); }
+	inline bool write(const lbyte& v) { return fast_write(v) || write_byte(v); }
+	inline bool write(const lint16& v) { return fast_write_int(v) || write_int16(v); }
+	inline bool write(const lint32& v) { return fast_write_int(v) || write_int32(v); }
+	inline bool write(const lint64& v) { return fast_write_int(v) || write_int64(v); }
+	inline bool write(const lfloat& v) { return fast_write(v) || write_float(v); }
+	inline bool write(const ldouble& v) { return fast_write(v) || write_double(v); }
+	inline bool write(const lstring& v) { return write_string(v); }
+	inline bool write(const LObject& v) { return write_object(&v); }
 
-	template<typename T>
-	inline bool write(const LRef<T>& v)
+	inline bool read(lbool& v) 
+	{ 
+		lbyte b = 0; 
+		if (!fast_read(b)) 
+			return read_bool(v); 
+		v = b == 0 ? false : true; 
+		return true; 
+	}
+	inline bool read(lbyte& v) { return fast_read(v) || read_byte(v); }
+	inline bool read(lint16& v) { return fast_read_int(v) || read_int16(v); }
+	inline bool read(lint32& v) { return fast_read_int(v) || read_int32(v); }
+	inline bool read(lint64& v) { return fast_read_int(v) || read_int64(v); }
+	inline bool read(lfloat& v) { return fast_read(v) || read_float(v); }
+	inline bool read(ldouble& v) { return fast_read(v) || read_double(v); }
+	inline bool read(lstring& v) { return read_string(v); }
+	inline bool read(LStringView& v) { return read_string_view(v); }
+	inline bool read(LObject& v) { return read_object(&v); }
+
+	// ref: # ref_id # object # on first write, # -ref_id # afterwards
+	template<typename T, typename P>
+	inline bool write(const LRef<T, P>& v)
 	{
-		write_ref_id(v.ref_id());
-		if (v.ref_id() == 0)
-			return true;
-		return write_object(v.get());
+		int ref_id = v.ref_id();
+		if (ref_id == 0)
+			return write_ref_id(0);
+		if (m_ref_linker)
+		{
+			m_ref_linker->link(v.get());
+			return write_ref_id(ref_id);
+		}
+		if (!m_ref_cache.mark_written(ref_id))
+			return write_ref_id(-ref_id);
+		return write_ref_id(ref_id) && write_object(v.get());
 	}
 
-	template<typename T>
-	inline bool read(LRef<T>& v)
+	template<typename T, typename P>
+	inline bool read(LRef<T, P>& v)
 	{
 		int ref_id = 0;
-		read_ref_id(ref_id);
-		v.set_ref_id(ref_id);
+		if (!read_ref_id(ref_id))
+			return false;
 		if (ref_id == 0)
+		{
+			v.reset();
+			return true;
+		}
+		if (m_ref_linker)
+			return read_linked_ref(ref_id, v);
+
+		LObject* cached = m_ref_cache.find(ref_id < 0 ? -ref_id : ref_id);
+		if (cached)
+		{
+			if (!cached->l_instance_of(T::l_meta_class()))
+			{
+				std::cout << "Ref Error! Class mismatch, ref_id:" << ref_id << std::endl;
+				return false;
+			}
+			v = LRef<T, P>(static_cast<T*>(cached));
+		}
+		else if (ref_id < 0)
+		{
+			std::cout << "Ref Error! Unknown back reference, ref_id:" << -ref_id << std::endl;
+			return false;
+		}
+		else
+		{
+			if (!v.get())
+				v = LRef<T, P>(T::l_new());
+			// register before reading fields, so cycles resolve to this object
+			m_ref_cache.insert(ref_id, v.get());
+		}
+
+		if (ref_id < 0)
 			return true;
-		if (!v.get()) // TODO: get object from ref_cache
-			v = LRef<T>(typename T::l_new());
 		return read_object(v.get());
 	}
+
+	// length prefix of strings and arrays
+	// compact: varint, fixed: int16, or kLongLength and int64 if it does not fit
+	static const lint16 kLongLength = 0x7fff;
+
+	inline bool write_length(size_t len)
+	{
+		if (m_wire_format == kWire_Compact)
+			return write_varint(len);
+		if (len < (size_t)kLongLength)
+			return write_int16((lint16)len);
+		lint16 marker = kLongLength;
+		return write_int16(marker) && write_int64((lint64)len);
+	}
+	inline bool read_length(size_t& len)
+	{
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 v = 0;
+			if (!read_varint(v))
+				return false;
+			len = (size_t)v;
+			return true;
+		}
+		lint16 v = 0;
+		if (!read_int16(v) || v < 0)
+			return false;
+		if (v != kLongLength)
+		{
+			len = (size_t)v;
+			return true;
+		}
+		lint64 v64 = 0;
+		if (!read_int64(v64) || v64 < kLongLength)
+			return false;
+		len = (size_t)v64;
+		return true;
+	}
+
+	inline LRefCache& ref_cache() { return m_ref_cache; }
+
+	// with a linker set, refs are written and read as ids only
+	inline LRefLinker* ref_linker() const { return m_ref_linker; }
+	inline void set_ref_linker(LRefLinker* linker) { m_ref_linker = linker; }
+
+	inline LWireFormat wire_format() const { return m_wire_format; }
+	inline void set_wire_format(LWireFormat format) { m_wire_format = format; }
+
+	static const size_t kMaxVarintLength = 10;
+
+	static inline luint64 zigzag_encode(lint64 v) 
+	{ 
+		return ((luint64)v << 1) ^ (luint64)(v >> 63); 
+	}
+	static inline lint64 zigzag_decode(luint64 v) 
+	{ 
+		return (lint64)(v >> 1) ^ -(lint64)(v & 1); 
+	}
+
+	// LEB128, returns encoded length, buf must hold kMaxVarintLength bytes
+	static inline size_t encode_varint(luint64 v, lbyte* buf)
+	{
+		size_t n = 0;
+		while (v >= 0x80)
+		{
+			buf[n++] = (lbyte)(v | 0x80);
+			v >>= 7;
+		}
+		buf[n++] = (lbyte)v;
+		return n;
+	}
+
+protected:
+	LStream()
+		: m_put_cur(NULL), m_put_end(NULL), m_get_cur(NULL), m_get_end(NULL),
+		m_wire_format(kWire_Fixed), m_ref_linker(NULL)
+	{
+	}
+
+	template<typename T, typename P>
+	bool read_linked_ref(int ref_id, LRef<T, P>& v)
+	{
+		LObject* obj = ref_id > 0 ? m_ref_linker->resolve(ref_id) : NULL;
+		if (!obj || !obj->l_instance_of(T::l_meta_class()))
+		{
+			std::cout << "Ref Error! Unresolved linked ref, ref_id:" << ref_id << std::endl;
+			return false;
+		}
+		// linkers may resolve the same object for several threads at once,
+		// see LSnapshot::load_all, so the count is always added atomically
+		obj->l_add_ref<LRefCountAtomic>();
+		v = LRef<T, P>::adopt(static_cast<T*>(obj));
+		return true;
+	}
+
+	//
+	// helpers for concrete streams, encode on top of write_bytes/read_bytes
+	//
+	bool write_varint(luint64 v)
+	{
+		if (fast_write_varint(v))
+			return true;
+		lbyte buf[kMaxVarintLength];
+		return write_bytes(buf, encode_varint(v, buf));
+	}
+
+	bool read_varint(luint64& v)
+	{
+		if (fast_read_varint(v))
+			return true;
+		v = 0;
+		for (size_t i = 0; i < kMaxVarintLength; ++i)
+		{
+			lbyte b = 0;
+			if (!read_bytes(&b, 1))
+				return false;
+			v |= (luint64)(b & 0x7f) << (7 * i);
+			if ((b & 0x80) == 0)
+				return true;
+		}
+		return false; // malformed
+	}
+
+	// ids are >= -1 (-1 terminates a field list), shift so they stay 1 byte when small
+	inline bool write_compact_id(int id) 
+	{ 
+		return write_varint((luint32)id + 1); 
+	}
+	inline bool read_compact_id(int& id)
+	{
+		luint64 v = 0;
+		if (!read_varint(v))
+			return false;
+		id = (int)((luint32)v - 1);
+		return true;
+	}
+
+	// copy raw value into the put window, false if window is too small
+	template<typename T>
+	inline bool fast_write(const T& v)
+	{
+		if ((size_t)(m_put_end - m_put_cur) < sizeof(T))
+			return false;
+		memcpy(m_put_cur, &v, sizeof(T));
+		m_put_cur += sizeof(T);
+		return true;
+	}
+
+	// copy raw value from the get window, false if window is too small
+	template<typename T>
+	inline bool fast_read(T& v)
+	{
+		if ((size_t)(m_get_end - m_get_cur) < sizeof(T))
+			return false;
+		memcpy(&v, m_get_cur, sizeof(T));
+		m_get_cur += sizeof(T);
+		return true;
+	}
+
+	// encode varint into the put window, false if window may be too small
+	inline bool fast_write_varint(luint64 v)
+	{
+		if ((size_t)(m_put_end - m_put_cur) < kMaxVarintLength)
+			return false;
+		m_put_cur += encode_varint(v, m_put_cur);
+		return true;
+	}
+
+	// decode varint from the get window, consumes nothing and
+	// returns false if it does not end inside the window
+	inline bool fast_read_varint(luint64& v)
+	{
+		const lbyte* p = m_get_cur;
+		luint64 r = 0;
+		for (size_t i = 0; i < kMaxVarintLength && p != m_get_end; ++i)
+		{
+			lbyte b = *p++;
+			r |= (luint64)(b & 0x7f) << (7 * i);
+			if ((b & 0x80) == 0)
+			{
+				v = r;
+				m_get_cur = p;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template<typename T>
+	inline bool fast_write_int(const T& v)
+	{
+		if (m_wire_format == kWire_Fixed)
+			return fast_write(v);
+		return fast_write_varint(zigzag_encode(v));
+	}
+
+	template<typename T>
+	inline bool fast_read_int(T& v)
+	{
+		if (m_wire_format == kWire_Fixed)
+			return fast_read(v);
+		luint64 u = 0;
+		if (!fast_read_varint(u))
+			return false;
+		v = (T)zigzag_decode(u);
+		return true;
+	}
+
+	// buffer windows of the fast path, 
+	// stay empty unless a memory-backed stream opens them
+	lbyte* m_put_cur;
+	lbyte* m_put_end;
+	const lbyte* m_get_cur;
+	const lbyte* m_get_end;
+
+	LWireFormat m_wire_format;
+	LRefCache m_ref_cache;
+	LRefLinker* m_ref_linker;
 };
 
 class LFStream : public LStream
 {
 public:
-	static const int kMaxStringLength = 1023;
+	// long strings are read in chunks, a corrupt length fails at end of file
+	// instead of allocating it up front
+	static const size_t kReadChunk = 64 * 1024;
 
 	// write functions
 	virtual bool write_type_id(const int& type_id) 
 	{ 
+		if (m_wire_format == kWire_Compact)
+			return write_compact_id(type_id);
 		return write_int32(type_id); 
 	}
 	virtual bool write_field_id(const int& field_id) 
 	{ 
+		if (m_wire_format == kWire_Compact)
+			return write_compact_id(field_id);
 		return write_int32(field_id); 
 	}
 	virtual bool write_ref_id(const int& ref_id) 
 	{ 
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(ref_id));
 		return write_int32(ref_id); 
 	}
 	virtual bool write_object(const LObject* o) 
@@ -127,14 +480,20 @@ public:
 	}
 	virtual bool write_int16(const lint16& v) 
 	{
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(v));
 		return write_bytes((const char*)&v, sizeof(lint16));
 	}
 	virtual bool write_int32(const lint32& v) 
 	{
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(v));
 		return write_bytes((const char*)&v, sizeof(lint32));
 	}
 	virtual bool write_int64(const lint64& v) 
 	{
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(v));
 		return write_bytes((const char*)&v, sizeof(lint64));
 	}
 	virtual bool write_float(const lfloat& v) 
@@ -147,28 +506,38 @@ public:
 	}
 	virtual bool write_string(const lstring& v) 
 	{
-		size_t write_len = v.size() < kMaxStringLength ? v.size() : kMaxStringLength;
-		write_int16(write_len);
-		write_bytes(v.c_str(), write_len);
-		return true;
+		return write_length(v.size()) && write_bytes(v.data(), v.size());
 	}
 	virtual bool write_bytes(const lbyte* buf, size_t len) 
 	{
 		m_fstream->write(buf, len);
+		m_bytes_written += len;
 		return true;
 	}
 
 	// read functions
 	virtual bool read_type_id(int& type_id) 
 	{ 
+		if (m_wire_format == kWire_Compact)
+			return read_compact_id(type_id);
 		return read_int32(type_id); 
 	}
 	virtual bool read_field_id(int& field_id) 
 	{ 
+		if (m_wire_format == kWire_Compact)
+			return read_compact_id(field_id);
 		return read_int32(field_id);
 	}
 	virtual bool read_ref_id(int& ref_id) 
 	{ 
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			ref_id = (int)zigzag_decode(u);
+			return true;
+		}
 		return read_int32(ref_id);
 	}
 	virtual bool read_object(LObject* o) 
@@ -191,14 +560,38 @@ public:
 	}
 	virtual bool read_int16(lint16& v) 
 	{
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			v = (lint16)zigzag_decode(u);
+			return true;
+		}
 		return read_bytes((lbyte*)&v, sizeof(lint16));
 	}
 	virtual bool read_int32(lint32& v) 
 	{
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			v = (lint32)zigzag_decode(u);
+			return true;
+		}
 		return read_bytes((lbyte*)&v, sizeof(lint32));
 	}
 	virtual bool read_int64(lint64& v) 
 	{
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			v = (lint64)zigzag_decode(u);
+			return true;
+		}
 		return read_bytes((lbyte*)&v, sizeof(lint64));
 	}
 	virtual bool read_float(lfloat& v) 
@@ -211,27 +604,34 @@ public:
 	}
 	virtual bool read_string(lstring& v) 
 	{
-		lint16 len = 0;
-		if (!read_int16(len))
-			return false;
-
-		if (!read_bytes(m_buffer, len))
+		size_t len = 0;
+		if (!read_length(len))
 			return false;
 
-		m_buffer[len] = '\0';
-		v.assign(m_buffer, m_buffer + len);
-
+		// read straight into the destination
+		v.clear();
+		for (size_t done = 0; done < len; )
+		{
+			size_t n = len - done < kReadChunk ? len - done : kReadChunk;
+			v.resize(done + n);
+			if (!read_bytes(&v[done], n))
+				return false;
+			done += n;
+		}
 		return true;
 	}
 	virtual bool read_bytes(lbyte* buf, size_t len) 
 	{
 		m_fstream->read(buf, len);
-		return true;
+		size_t n = (size_t)m_fstream->gcount();
+		m_bytes_read += n;
+		return n == len;
 	}
 
+	virtual size_t bytes_written() const { return m_bytes_written; }
+	virtual size_t bytes_read() const { return m_bytes_read; }
 
-
-	LFStream() : m_fstream(NULL)
+	LFStream() : m_fstream(NULL), m_bytes_written(0), m_bytes_read(0)
 	{
 	}
 
@@ -245,7 +645,340 @@ public:
 	}
 
 	std::fstream* m_fstream;
-	char m_buffer[kMaxStringLength + 1];
+	size_t m_bytes_written;
+	size_t m_bytes_read;
+};
+
+//
+// LBufferStream - encoding on top of the buffer windows
+//	- everything is written into the put window and read from the get window,
+//	  subclasses own the memory behind them
+//
+class LBufferStream : public LStream
+{
+public:
+	// write functions
+	virtual bool write_type_id(const int& type_id) 
+	{ 
+		if (m_wire_format == kWire_Compact)
+			return write_compact_id(type_id);
+		return write_int32(type_id); 
+	}
+	virtual bool write_field_id(const int& field_id) 
+	{ 
+		if (m_wire_format == kWire_Compact)
+			return write_compact_id(field_id);
+		return write_int32(field_id); 
+	}
+	virtual bool write_ref_id(const int& ref_id) 
+	{ 
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(ref_id));
+		return write_int32(ref_id); 
+	}
+	virtual bool write_object(const LObject* o) 
+	{
+		o->l_class()->serializer()(*this, o);
+		return true;
+	}
+
+	virtual bool write_bool(const lbool& v) 
+	{
+		return write_byte(v ? 1 : 0);
+	}
+	virtual bool write_byte(const lbyte& v) 
+	{
+		return put_bytes((const lbyte*)&v, sizeof(lbyte));
+	}
+	virtual bool write_int16(const lint16& v) 
+	{
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(v));
+		return put_bytes((const lbyte*)&v, sizeof(lint16));
+	}
+	virtual bool write_int32(const lint32& v) 
+	{
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(v));
+		return put_bytes((const lbyte*)&v, sizeof(lint32));
+	}
+	virtual bool write_int64(const lint64& v) 
+	{
+		if (m_wire_format == kWire_Compact)
+			return write_varint(zigzag_encode(v));
+		return put_bytes((const lbyte*)&v, sizeof(lint64));
+	}
+	virtual bool write_float(const lfloat& v) 
+	{
+		return put_bytes((const lbyte*)&v, sizeof(lfloat));
+	}
+	virtual bool write_double(const ldouble& v) 
+	{
+		return put_bytes((const lbyte*)&v, sizeof(ldouble));
+	}
+	virtual bool write_string(const lstring& v) 
+	{
+		return write_length(v.size()) && write_bytes(v.data(), v.size());
+	}
+	virtual bool write_bytes(const lbyte* buf, size_t len) 
+	{
+		return put_bytes(buf, len);
+	}
+
+	// read functions
+	virtual bool read_type_id(int& type_id) 
+	{ 
+		if (m_wire_format == kWire_Compact)
+			return read_compact_id(type_id);
+		return read_int32(type_id); 
+	}
+	virtual bool read_field_id(int& field_id) 
+	{ 
+		if (m_wire_format == kWire_Compact)
+			return read_compact_id(field_id);
+		return read_int32(field_id);
+	}
+	virtual bool read_ref_id(int& ref_id) 
+	{ 
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			ref_id = (int)zigzag_decode(u);
+			return true;
+		}
+		return read_int32(ref_id);
+	}
+	virtual bool read_object(LObject* o) 
+	{
+		o->l_class()->deserializer()(*this, o);
+		return true;
+	}
+
+	virtual bool read_bool(lbool& v) 
+	{
+		lbyte b = 0;
+		if (!read_byte(b))
+			return false;
+		v = b == 0 ? false : true;
+		return true;
+	}
+	virtual bool read_byte(lbyte& v) 
+	{
+		return get_bytes((lbyte*)&v, sizeof(lbyte));
+	}
+	virtual bool read_int16(lint16& v) 
+	{
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			v = (lint16)zigzag_decode(u);
+			return true;
+		}
+		return get_bytes((lbyte*)&v, sizeof(lint16));
+	}
+	virtual bool read_int32(lint32& v) 
+	{
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			v = (lint32)zigzag_decode(u);
+			return true;
+		}
+		return get_bytes((lbyte*)&v, sizeof(lint32));
+	}
+	virtual bool read_int64(lint64& v) 
+	{
+		if (m_wire_format == kWire_Compact)
+		{
+			luint64 u = 0;
+			if (!read_varint(u))
+				return false;
+			v = (lint64)zigzag_decode(u);
+			return true;
+		}
+		return get_bytes((lbyte*)&v, sizeof(lint64));
+	}
+	virtual bool read_float(lfloat& v) 
+	{
+		return get_bytes((lbyte*)&v, sizeof(lfloat));
+	}
+	virtual bool read_double(ldouble& v) 
+	{
+		return get_bytes((lbyte*)&v, sizeof(ldouble));
+	}
+	virtual bool read_string(lstring& v) 
+	{
+		size_t len = 0;
+		if (!read_length(len))
+			return false;
+
+		sync_get();
+		if ((size_t)(m_get_end - m_get_cur) < len)
+			return false;
+
+		// copy straight from the buffer, no staging
+		v.assign(m_get_cur, m_get_cur + len);
+		m_get_cur += len;
+
+		return true;
+	}
+	virtual bool read_string_view(LStringView& v) 
+	{
+		size_t len = 0;
+		if (!read_length(len))
+			return false;
+
+		sync_get();
+		if ((size_t)(m_get_end - m_get_cur) < len)
+			return false;
+
+		v = LStringView(m_get_cur, len);
+		m_get_cur += len;
+
+		return true;
+	}
+	virtual bool read_bytes(lbyte* buf, size_t len) 
+	{
+		return get_bytes(buf, len);
+	}
+
+	// the next len bytes in place and skip them, NULL if fewer are buffered,
+	// valid until the next write
+	inline const lbyte* read_span(size_t len)
+	{
+		sync_get();
+		if ((size_t)(m_get_end - m_get_cur) < len)
+			return NULL;
+		const lbyte* span = m_get_cur;
+		m_get_cur += len;
+		return span;
+	}
+
+protected:
+	LBufferStream()
+		: m_get_follows_put(false)
+	{
+	}
+
+	// make room for len more bytes in the put window, false if it can not
+	virtual bool grow(size_t len) = 0;
+
+	// window copies, inlined so fixed size values compile to plain moves
+	inline bool put_bytes(const lbyte* buf, size_t len)
+	{
+		if ((size_t)(m_put_end - m_put_cur) < len)
+			return grow_put_bytes(buf, len);
+		memcpy(m_put_cur, buf, len);
+		m_put_cur += len;
+		return true;
+	}
+	inline bool get_bytes(lbyte* buf, size_t len)
+	{
+		sync_get();
+		if ((size_t)(m_get_end - m_get_cur) < len)
+			return false;
+		memcpy(buf, m_get_cur, len);
+		m_get_cur += len;
+		return true;
+	}
+	// slow path of put_bytes, out of line
+	bool grow_put_bytes(const lbyte* buf, size_t len);
+
+	// expose bytes written after the last read window update
+	inline void sync_get()
+	{
+		if (m_get_follows_put)
+			m_get_end = m_put_cur;
+	}
+
+	// get window ends where the put window starts, see LMemStream
+	bool m_get_follows_put;
+};
+
+//
+// LMemStream - contiguous growable memory buffer
+//	- writes append to the buffer, reads consume from the read position
+//	- reset() drops the content but keeps the capacity for reuse
+//
+class LMemStream : public LBufferStream
+{
+public:
+	static const size_t kDefaultCapacity = 256;
+
+	virtual size_t bytes_written() const { return size(); }
+	virtual size_t bytes_read() const { return read_pos(); }
+
+	LMemStream(size_t capacity = kDefaultCapacity)
+	{
+		m_get_follows_put = true;
+		reserve(capacity);
+	}
+
+	// make sure capacity for at least _capacity bytes without further allocation
+	void reserve(size_t _capacity)
+	{
+		if (_capacity <= m_buffer.size())
+			return;
+		size_t put_pos = size();
+		size_t get_pos = read_pos();
+		m_buffer.resize(_capacity);
+		m_put_cur = &m_buffer[0] + put_pos;
+		m_put_end = &m_buffer[0] + m_buffer.size();
+		m_get_cur = &m_buffer[0] + get_pos;
+		m_get_end = m_put_cur;
+	}
+
+	// drop content and rewind, keep capacity for reuse
+	inline void reset()
+	{
+		m_put_cur = data();
+		m_get_cur = m_get_end = data();
+	}
+
+	// rewind read position to the beginning of the content
+	inline void rewind()
+	{
+		m_get_cur = data();
+		m_get_end = m_put_cur;
+	}
+
+	// replace content with a copy of buf, read position is rewound
+	void assign(const lbyte* buf, size_t len)
+	{
+		reset();
+		write_bytes(buf, len);
+		rewind();
+	}
+
+	inline lbyte* data() { return m_buffer.empty() ? NULL : &m_buffer[0]; }
+	inline const lbyte* data() const { return m_buffer.empty() ? NULL : &m_buffer[0]; }
+	inline size_t size() const { return (size_t)(m_put_cur - data()); }
+	inline size_t capacity() const { return m_buffer.size(); }
+	inline size_t read_pos() const { return (size_t)(m_get_cur - data()); }
+	inline size_t readable() const { return (size_t)(m_put_cur - m_get_cur); }
+
+private:
+	// not copyable, the windows point into m_buffer
+	LMemStream(const LMemStream&);
+	LMemStream& operator=(const LMemStream&);
+
+	virtual bool grow(size_t len)
+	{
+		size_t need = size() + len;
+		size_t cap = m_buffer.size() ? m_buffer.size() : kDefaultCapacity;
+		while (cap < need)
+			cap *= 2;
+		reserve(cap);
+		return true;
+	}
+
+	std::vector<lbyte> m_buffer;
 };
 
 
@@ -0,0 +1,524 @@
+#include "ltcp.h"
+
+#if !defined(__linux__)
+#error "ltcp.cpp is built on epoll, Linux only"
+#endif
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace lros {
+
+//////////////////////////////////////////////////////////////////////////
+// LTcpStream
+LTcpStream::LTcpStream(LTcpLoop* loop, int fd, int id)
+	: m_loop(loop), m_fd(fd), m_id(id),
+	m_out_sent(0), m_frame_start(0), m_bytes_queued(0),
+	m_segment_sent(0), m_segment_bytes(0), m_frame_segment_bytes(0),
+	m_in_begin(0), m_in_end(0), m_frame_end(0), m_bytes_consumed(0),
+	m_connecting(false), m_want_write(false), m_in_output(false), m_error(false)
+{
+	// the open frame always has its header reserved
+	reserve_out(LMemStream::kDefaultCapacity);
+	m_put_cur += kHeaderSize;
+}
+
+LTcpStream::~LTcpStream()
+{
+}
+
+size_t LTcpStream::bytes_written() const
+{
+	return m_bytes_queued + (size_t)(m_put_cur - (m_out.data() + m_frame_start)) - kHeaderSize 
+		+ m_frame_segment_bytes;
+}
+
+size_t LTcpStream::bytes_read() const
+{
+	if (!m_frame_end)
+		return m_bytes_consumed;
+	return m_bytes_consumed + (size_t)(m_get_cur - (m_in.data() + m_in_begin)) - kHeaderSize;
+}
+
+bool LTcpStream::end_frame()
+{
+	// refs do not back reference across frames
+	ref_cache().clear_written();
+	lbyte* header = m_out.data() + m_frame_start;
+	size_t len = (size_t)(m_put_cur - header) - kHeaderSize + m_frame_segment_bytes;
+	if (len == 0)
+		return true;
+	if (len > kMaxFrameSize)
+	{
+		std::cout << "Tcp Error! Frame too large:" << len << std::endl;
+		m_put_cur = header + kHeaderSize;
+		while (!m_segments.empty() && m_segments.back().pos > m_frame_start)
+			m_segments.pop_back();
+		m_segment_bytes -= m_frame_segment_bytes;
+		m_frame_segment_bytes = 0;
+		return false;
+	}
+
+	luint32 n = (luint32)len;
+	memcpy(header, &n, sizeof(n));
+	m_bytes_queued += len;
+	m_frame_segment_bytes = 0;
+	m_frame_start = (size_t)(m_put_cur - m_out.data());
+	if ((size_t)(m_put_end - m_put_cur) < kHeaderSize)
+		grow(kHeaderSize);
+	m_put_cur += kHeaderSize;
+
+	if (m_loop && !m_in_output)
+		m_loop->queue_output(this);
+	return true;
+}
+
+void LTcpStream::write_segment(const LSegmentRef& segment)
+{
+	if (segment.size() == 0)
+		return;
+	OutSegment out;
+	out.pos = (size_t)(m_put_cur - m_out.data());
+	out.segment = segment;
+	m_segments.push_back(std::move(out));
+	m_segment_bytes += segment.size();
+	m_frame_segment_bytes += segment.size();
+}
+
+bool LTcpStream::next_frame()
+{
+	ref_cache().clear();
+	if (m_frame_end)
+	{
+		m_bytes_consumed += m_frame_end - m_in_begin - kHeaderSize;
+		m_in_begin = m_frame_end;
+		m_frame_end = 0;
+	}
+	m_get_cur = m_get_end = NULL;
+	if (m_error || m_in_end - m_in_begin < kHeaderSize)
+		return false;
+
+	luint32 len = 0;
+	memcpy(&len, m_in.data() + m_in_begin, sizeof(len));
+	if (len > kMaxFrameSize)
+	{
+		std::cout << "Tcp Error! Invalid frame length:" << len << std::endl;
+		m_error = true;
+		return false;
+	}
+	if (m_in_end - m_in_begin - kHeaderSize < len)
+		return false;
+
+	m_frame_end = m_in_begin + kHeaderSize + len;
+	m_get_cur = m_in.data() + m_in_begin + kHeaderSize;
+	m_get_end = m_in.data() + m_frame_end;
+	return true;
+}
+
+bool LTcpStream::grow(size_t len)
+{
+	compact_out();
+	size_t used = (size_t)(m_put_cur - m_out.data());
+	if (m_out.size() - used >= len)
+		return true;
+	size_t cap = m_out.size();
+	while (cap - used < len)
+		cap *= 2;
+	reserve_out(cap);
+	return true;
+}
+
+void LTcpStream::consume_out(size_t n)
+{
+	while (n > 0)
+	{
+		if (!m_segments.empty() && m_segments.front().pos == m_out_sent)
+		{
+			OutSegment& out = m_segments.front();
+			size_t k = std::min(n, out.segment.size() - m_segment_sent);
+			m_segment_sent += k;
+			m_segment_bytes -= k;
+			n -= k;
+			if (m_segment_sent == out.segment.size())
+			{
+				m_segments.pop_front();
+				m_segment_sent = 0;
+			}
+			continue;
+		}
+		size_t end = m_segments.empty() ? m_frame_start : std::min(m_segments.front().pos, m_frame_start);
+		size_t k = std::min(n, end - m_out_sent);
+		assert(k > 0);
+		m_out_sent += k;
+		n -= k;
+	}
+}
+
+void LTcpStream::compact_out()
+{
+	if (m_out_sent == 0)
+		return;
+	size_t used = (size_t)(m_put_cur - m_out.data());
+	memmove(m_out.data(), m_out.data() + m_out_sent, used - m_out_sent);
+	m_put_cur -= m_out_sent;
+	m_frame_start -= m_out_sent;
+	for (OutSegment& out : m_segments)
+		out.pos -= m_out_sent;
+	m_out_sent = 0;
+}
+
+void LTcpStream::reserve_out(size_t capacity)
+{
+	size_t used = m_out.empty() ? 0 : (size_t)(m_put_cur - m_out.data());
+	m_out.resize(capacity);
+	m_put_cur = m_out.data() + used;
+	m_put_end = m_out.data() + m_out.size();
+}
+
+bool LTcpStream::recv_some()
+{
+	// the frame open for reading is dropped, its window would move
+	if (m_frame_end)
+	{
+		m_bytes_consumed += m_frame_end - m_in_begin - kHeaderSize;
+		m_in_begin = m_frame_end;
+		m_frame_end = 0;
+	}
+	m_get_cur = m_get_end = NULL;
+	if (m_in_begin > 0)
+	{
+		memmove(m_in.data(), m_in.data() + m_in_begin, m_in_end - m_in_begin);
+		m_in_end -= m_in_begin;
+		m_in_begin = 0;
+	}
+
+	// a full buffer holds at least one complete frame, the rest stays in
+	// the socket, level-triggered EPOLLIN resumes once frames are consumed
+	while (m_in_end < kMaxBuffered)
+	{
+		if (m_in.size() - m_in_end < kRecvChunk && m_in.size() < kMaxBuffered)
+			m_in.resize(m_in_end + kRecvChunk < kMaxBuffered ? m_in_end + kRecvChunk : kMaxBuffered);
+		ssize_t n = ::recv(m_fd, m_in.data() + m_in_end, m_in.size() - m_in_end, 0);
+		if (n > 0)
+		{
+			m_in_end += (size_t)n;
+			continue;
+		}
+		if (n == 0)
+			return false;
+		if (errno == EINTR)
+			continue;
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+	}
+	return true;
+}
+
+bool LTcpStream::send_some()
+{
+	static const size_t kMaxIov = 64;
+	while (queued_bytes() > 0)
+	{
+		// queued bytes of m_out with the segments spliced in at their pos
+		iovec iov[kMaxIov];
+		size_t count = 0;
+		size_t cursor = m_out_sent;
+		size_t skip = m_segment_sent;
+		size_t i = 0;
+		for (; i < m_segments.size() && m_segments[i].pos <= m_frame_start && count + 2 <= kMaxIov; ++i)
+		{
+			const OutSegment& out = m_segments[i];
+			if (out.pos > cursor)
+			{
+				iov[count].iov_base = m_out.data() + cursor;
+				iov[count++].iov_len = out.pos - cursor;
+				cursor = out.pos;
+			}
+			iov[count].iov_base = (void*)(out.segment.data() + skip);
+			iov[count++].iov_len = out.segment.size() - skip;
+			skip = 0;
+		}
+		size_t end = i < m_segments.size() && m_segments[i].pos <= m_frame_start ? m_segments[i].pos : m_frame_start;
+		if (end > cursor && count < kMaxIov)
+		{
+			iov[count].iov_base = m_out.data() + cursor;
+			iov[count++].iov_len = end - cursor;
+		}
+
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t n = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			consume_out((size_t)n);
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		return false;
+	}
+	// all sent, the open frame moves back to the front
+	compact_out();
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LTcpLoop
+static bool l_tcp_address(const char* host, int port, sockaddr_in& addr)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	return inet_pton(AF_INET, host, &addr.sin_addr) == 1;
+}
+
+LTcpLoop::LTcpLoop(LTcpHandler* handler)
+	: m_handler(handler), m_listen_fd(-1), m_port(0), m_next_id(1)
+{
+	m_epoll = epoll_create1(EPOLL_CLOEXEC);
+}
+
+LTcpLoop::~LTcpLoop()
+{
+	std::vector<LTcpStream*> streams;
+	for (auto& it : m_streams)
+		streams.push_back(it.second);
+	for (LTcpStream* s : streams)
+		close(s);
+	reap();
+	if (m_listen_fd >= 0)
+		::close(m_listen_fd);
+	if (m_epoll >= 0)
+		::close(m_epoll);
+}
+
+bool LTcpLoop::listen(const char* host, int port, int backlog)
+{
+	sockaddr_in addr;
+	if (m_epoll < 0 || m_listen_fd >= 0 || !l_tcp_address(host, port, addr))
+		return false;
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	socklen_t len = sizeof(addr);
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, backlog) != 0
+		|| getsockname(fd, (sockaddr*)&addr, &len) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;	// the listener
+	if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+	m_listen_fd = fd;
+	m_port = ntohs(addr.sin_port);
+	return true;
+}
+
+LTcpStream* LTcpLoop::connect(const char* host, int port)
+{
+	sockaddr_in addr;
+	if (m_epoll < 0 || !l_tcp_address(host, port, addr))
+		return NULL;
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS)
+	{
+		::close(fd);
+		return NULL;
+	}
+	return add_stream(fd, true);
+}
+
+LTcpStream* LTcpLoop::add_stream(int fd, bool connecting)
+{
+	// frames are coalesced here, Nagle would only add latency
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	LTcpStream* s = new LTcpStream(this, fd, m_next_id++);
+	s->m_connecting = connecting;
+	s->m_want_write = connecting;
+	epoll_event ev;
+	ev.events = EPOLLIN | (connecting ? EPOLLOUT : 0);
+	ev.data.ptr = s;
+	if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		::close(fd);
+		delete s;
+		return NULL;
+	}
+	m_streams[s->m_id] = s;
+	return s;
+}
+
+void LTcpLoop::accept_all()
+{
+	while (true)
+	{
+		int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+		LTcpStream* s = add_stream(fd, false);
+		if (s && m_handler)
+			m_handler->on_open(*s);
+	}
+}
+
+int LTcpLoop::poll(int timeout_ms)
+{
+	if (m_epoll < 0)
+		return -1;
+
+	// frames queued since the last poll go out before waiting
+	flush();
+
+	static const int kMaxEvents = 64;
+	epoll_event events[kMaxEvents];
+	int n = epoll_wait(m_epoll, events, kMaxEvents, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+
+	int frames = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		LTcpStream* s = (LTcpStream*)events[i].data.ptr;
+		if (!s)
+		{
+			accept_all();
+			continue;
+		}
+		if (!s->is_open())
+			continue;
+
+		const luint32 ev = events[i].events;
+		if (s->m_connecting && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+		{
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (getsockopt(s->m_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+			{
+				close(s);
+				continue;
+			}
+			s->m_connecting = false;
+			if (m_handler)
+				m_handler->on_open(*s);
+		}
+		if ((ev & EPOLLOUT) && s->is_open() && !s->m_connecting)
+		{
+			if (!s->send_some())
+			{
+				close(s);
+				continue;
+			}
+			watch_write(s, s->queued_bytes() > 0);
+		}
+		if ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) && s->is_open())
+		{
+			// frames that arrived before the end of the stream are still handled
+			bool alive = s->recv_some();
+			dispatch(s, frames);
+			if (!alive || s->m_error)
+				close(s);
+		}
+	}
+
+	// replies written by the handlers are coalesced into one send
+	flush();
+	reap();
+	return frames;
+}
+
+void LTcpLoop::flush()
+{
+	for (size_t i = 0; i < m_output.size(); ++i)
+	{
+		LTcpStream* s = m_output[i];
+		s->m_in_output = false;
+		if (!s->is_open() || s->m_connecting)
+			continue;
+		if (!s->send_some())
+		{
+			close(s);
+			continue;
+		}
+		watch_write(s, s->queued_bytes() > 0);
+	}
+	m_output.clear();
+}
+
+void LTcpLoop::close(LTcpStream* s)
+{
+	if (!s->is_open())
+		return;
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, s->m_fd, NULL);
+	::close(s->m_fd);
+	s->m_fd = -1;
+	if (m_handler)
+		m_handler->on_close(*s);
+	m_closed.push_back(s);
+}
+
+void LTcpLoop::queue_output(LTcpStream* s)
+{
+	s->m_in_output = true;
+	m_output.push_back(s);
+}
+
+void LTcpLoop::watch_write(LTcpStream* s, bool on)
+{
+	if (s->m_want_write == on)
+		return;
+	epoll_event ev;
+	ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+	ev.data.ptr = s;
+	epoll_ctl(m_epoll, EPOLL_CTL_MOD, s->m_fd, &ev);
+	s->m_want_write = on;
+}
+
+void LTcpLoop::dispatch(LTcpStream* s, int& frames)
+{
+	while (s->is_open() && s->next_frame())
+	{
+		++frames;
+		if (m_handler)
+			m_handler->on_frame(*s);
+	}
+}
+
+void LTcpLoop::reap()
+{
+	for (LTcpStream* s : m_closed)
+	{
+		m_streams.erase(s->m_id);
+		delete s;
+	}
+	m_closed.clear();
+}
+
+}//lros
@@ -0,0 +1,192 @@
+#ifndef LROS_TCP_H_
+#define LROS_TCP_H_
+
+#include "lobject.h"
+#include "lstream.h"
+#include "lsegment.h"
+
+#include <deque>
+#include <unordered_map>
+
+//
+// TCP Transport, non-blocking sockets driven by one epoll loop
+//	- frame		: # luint32 length # payload #, native byte order
+//	- payload	: anything written through the LStream api, e.g. one
+//	  replication packet, see LReplicaHost::flush/LReplicaSlave::apply
+//	- frames ended between two sends go out in one send() per stream,
+//	  shared segments in them are sent in place by scatter-gather
+//	- partial frames stay buffered until the rest arrives
+//	- Linux only, ltcp.cpp is left out of other builds
+//
+
+namespace lros
+{
+
+class LTcpLoop;
+
+//
+// LTcpStream - one connection, owned by its LTcpLoop
+//	- write side: write the payload, then end_frame() queues it, the
+//	  loop sends all queued frames at the end of poll() or on flush()
+//	- write_segment() adds a shared segment to the frame without copying
+//	  it, the stream keeps a reference until it is sent
+//	- read side: next_frame() opens the next complete frame for reading,
+//	  the frame stays readable until the next next_frame() or poll()
+//	- a peer sending faster than frames are read is held back by the
+//	  socket, no more than kMaxBuffered bytes are buffered per stream
+//	- the ref cache is scoped to one frame on both sides
+//
+class LTcpStream : public LBufferStream
+{
+public:
+	// upper bound of one frame, larger ones close the connection
+	static const size_t kMaxFrameSize = 16 * 1024 * 1024;
+	static const size_t kHeaderSize = sizeof(luint32);
+	// bytes asked from the socket at least per recv()
+	static const size_t kRecvChunk = 64 * 1024;
+	// received bytes buffered at most, one largest frame with its header
+	static const size_t kMaxBuffered = kMaxFrameSize + kHeaderSize;
+
+	// queue the frame written since the last end_frame(), an empty frame
+	// is not sent, false if it is larger than kMaxFrameSize
+	bool end_frame();
+	// append segment to the open frame by reference
+	void write_segment(const LSegmentRef& segment);
+	// complete frames not sent yet
+	inline size_t queued_bytes() const { return m_frame_start - m_out_sent + m_segment_bytes - m_frame_segment_bytes; }
+
+	// true if a complete frame is open for reading, drops the previous one
+	bool next_frame();
+	inline size_t frame_size() const { return m_frame_end ? m_frame_end - m_in_begin - kHeaderSize : 0; }
+
+	inline int id() const { return m_id; }
+	inline bool is_open() const { return m_fd >= 0; }
+	inline LTcpLoop* loop() const { return m_loop; }
+
+	virtual size_t bytes_written() const;
+	virtual size_t bytes_read() const;
+
+private:
+	friend class LTcpLoop;
+
+	LTcpStream(LTcpLoop* loop, int fd, int id);
+	virtual ~LTcpStream();
+	LTcpStream(const LTcpStream&);
+	LTcpStream& operator=(const LTcpStream&);
+
+	virtual bool grow(size_t len);
+
+	// recv until the socket would block or kMaxBuffered bytes are buffered,
+	// false on error or end of stream
+	bool recv_some();
+	// send queued frames until the socket would block, false on error
+	bool send_some();
+	// mark n bytes of the queued frames as sent
+	void consume_out(size_t n);
+	// move unsent bytes to the front of the output buffer
+	void compact_out();
+	// resize the output buffer, the put window follows it
+	void reserve_out(size_t capacity);
+
+	LTcpLoop* m_loop;
+	int m_fd;
+	int m_id;
+
+	std::vector<lbyte> m_out;	// [sent, frame_start) queued frames, then the open frame
+	size_t m_out_sent;
+	size_t m_frame_start;		// header of the open frame
+	size_t m_bytes_queued;		// payload of all ended frames
+
+	// segment sent after the bytes of m_out before pos
+	struct OutSegment
+	{
+		size_t pos;
+		LSegmentRef segment;
+	};
+	std::deque<OutSegment> m_segments;
+	size_t m_segment_sent;			// of the first segment
+	size_t m_segment_bytes;			// not sent yet, open frame included
+	size_t m_frame_segment_bytes;	// in the open frame
+
+	std::vector<lbyte> m_in;	// [begin, end) received, not consumed
+	size_t m_in_begin;
+	size_t m_in_end;
+	size_t m_frame_end;			// end of the frame open for reading, 0 if none
+	size_t m_bytes_consumed;	// payload of all dropped frames
+
+	bool m_connecting;
+	bool m_want_write;			// EPOLLOUT registered
+	bool m_in_output;			// in LTcpLoop::m_output
+	bool m_error;				// malformed frame, closed at the end of poll()
+};
+
+//
+// LTcpHandler - events of an LTcpLoop, called from poll() only
+//
+class LTcpHandler
+{
+public:
+	virtual ~LTcpHandler() {}
+	// accepted, or connect() completed
+	virtual void on_open(LTcpStream& s) { (void)s; }
+	// a frame is open for reading
+	virtual void on_frame(LTcpStream& s) = 0;
+	// s is closed and deleted after the call
+	virtual void on_close(LTcpStream& s) { (void)s; }
+};
+
+//
+// LTcpLoop - one thread serves any number of streams
+//	- listen() and connect() streams share the loop
+//	- level-triggered, EPOLLOUT is only watched while a send would block
+//
+class LTcpLoop
+{
+public:
+	explicit LTcpLoop(LTcpHandler* handler);
+	~LTcpLoop();
+
+	// IPv4, port 0 binds any free port, see port()
+	bool listen(const char* host, int port, int backlog = 128);
+	inline int port() const { return m_port; }
+
+	// NULL on immediate failure, frames may be queued before on_open()
+	LTcpStream* connect(const char* host, int port);
+
+	// wait up to timeout_ms (-1 forever) for socket events, hand complete
+	// frames to the handler, then send what was queued, returns the number
+	// of frames handled or -1 if the loop is unusable
+	int poll(int timeout_ms);
+	// send the frames queued on all streams now
+	void flush();
+	// on_close() is called now, the stream is deleted at the end of poll()
+	void close(LTcpStream* s);
+
+	inline size_t stream_count() const { return m_streams.size(); }
+
+private:
+	LTcpLoop(const LTcpLoop&);
+	LTcpLoop& operator=(const LTcpLoop&);
+
+	friend class LTcpStream;
+
+	void accept_all();
+	LTcpStream* add_stream(int fd, bool connecting);
+	void queue_output(LTcpStream* s);
+	void watch_write(LTcpStream* s, bool on);
+	void dispatch(LTcpStream* s, int& frames);
+	void reap();
+
+	LTcpHandler* m_handler;
+	int m_epoll;
+	int m_listen_fd;
+	int m_port;
+	int m_next_id;
+	std::unordered_map<int, LTcpStream*> m_streams;	// by id, owned
+	std::vector<LTcpStream*> m_output;				// frames ended since last flush
+	std::vector<LTcpStream*> m_closed;				// deleted by reap()
+};
+
+}//lros
+
+#endif //LROS_TCP_H_
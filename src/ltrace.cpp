@@ -0,0 +1,184 @@
+#include "ltrace.h"
+
+#include <cstring>
+#include <mutex>
+
+namespace lros {
+
+std::atomic<bool> LTrace::s_enabled(false);
+
+//
+// counters of one thread, two-level table indexed by class id,
+// pages and counters are allocated by the owner and published with release.
+// blocks are never freed, counters of exited threads stay in snapshots
+//
+namespace
+{
+	const int kPageBits = 8;
+	const int kPageSize = 1 << kPageBits;
+	const int kPageCount = (kTypeIDUserMax >> kPageBits) + 1;
+
+	struct TracePage
+	{
+		std::atomic<LTraceCounters*> counters[kPageSize];
+	};
+
+	struct TraceThread
+	{
+		std::atomic<TracePage*> pages[kPageCount];
+	};
+
+	std::mutex& thread_mutex()
+	{
+		static std::mutex* s_mutex = new std::mutex;
+		return *s_mutex;
+	}
+
+	std::vector<TraceThread*>& thread_list()
+	{
+		static std::vector<TraceThread*>* s_threads = new std::vector<TraceThread*>;
+		return *s_threads;
+	}
+
+	TraceThread* this_thread()
+	{
+		static thread_local TraceThread* t_thread = NULL;
+		if (!t_thread)
+		{
+			t_thread = new TraceThread();
+			std::lock_guard<std::mutex> lock(thread_mutex());
+			thread_list().push_back(t_thread);
+		}
+		return t_thread;
+	}
+}
+
+void LTrace::set_enabled(bool enabled)
+{
+	s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+LTraceCounters* LTrace::counters(int class_id)
+{
+	if ((unsigned)class_id > (unsigned)kTypeIDUserMax)
+		return NULL;
+
+	TraceThread* t = this_thread();
+	std::atomic<TracePage*>& page_slot = t->pages[class_id >> kPageBits];
+	TracePage* page = page_slot.load(std::memory_order_relaxed);
+	if (!page)
+	{
+		page = new TracePage();
+		page_slot.store(page, std::memory_order_release);
+	}
+
+	std::atomic<LTraceCounters*>& slot = page->counters[class_id & (kPageSize - 1)];
+	LTraceCounters* c = slot.load(std::memory_order_relaxed);
+	if (!c)
+	{
+		c = new LTraceCounters();
+		slot.store(c, std::memory_order_release);
+	}
+	return c;
+}
+
+void LTrace::snapshot(std::vector<LTraceClassStats>& stats)
+{
+	stats.clear();
+	std::vector<int> index(kTypeIDUserMax + 1, -1);
+
+	std::lock_guard<std::mutex> lock(thread_mutex());
+	for (TraceThread* t : thread_list())
+	{
+		for (int p = 0; p < kPageCount; ++p)
+		{
+			TracePage* page = t->pages[p].load(std::memory_order_acquire);
+			if (!page)
+				continue;
+			for (int i = 0; i < kPageSize; ++i)
+			{
+				LTraceCounters* c = page->counters[i].load(std::memory_order_acquire);
+				if (!c)
+					continue;
+
+				int class_id = (p << kPageBits) | i;
+				if (index[class_id] < 0)
+				{
+					LTraceClassStats s;
+					memset(&s, 0, sizeof(s));
+					s.class_id = class_id;
+					const LClass* cls = LClass::class_for(class_id);
+					s.class_name = cls ? cls->class_name() : "?";
+					index[class_id] = (int)stats.size();
+					stats.push_back(s);
+				}
+
+				LTraceClassStats& s = stats[index[class_id]];
+				for (int e = 0; e < kTraceEventMax; ++e)
+				{
+					s.events[e] += c->events[e].load(std::memory_order_relaxed);
+					s.bytes[e] += c->bytes[e].load(std::memory_order_relaxed);
+					s.nanos[e] += c->nanos[e].load(std::memory_order_relaxed);
+				}
+				for (int f = 0; f < kMaxFiledIDNum; ++f)
+				{
+					s.field_events[f] += c->field_events[f].load(std::memory_order_relaxed);
+					s.field_bytes[f] += c->field_bytes[f].load(std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+}
+
+void LTrace::dump(std::ostream& os)
+{
+	static const char* s_event_names[kTraceEventMax] =
+	{
+		"construct", "serialize", "serialize_delta", "deserialize",
+	};
+
+	std::vector<LTraceClassStats> stats;
+	snapshot(stats);
+	for (const auto& s : stats)
+	{
+		os << "===== [" << s.class_name << "] id:" << s.class_id << " =====" << std::endl;
+		for (int e = 0; e < kTraceEventMax; ++e)
+		{
+			if (!s.events[e])
+				continue;
+			os << s_event_names[e] << "\tcount:" << s.events[e]
+				<< "\tbytes:" << s.bytes[e] << "\tns:" << s.nanos[e] << std::endl;
+		}
+		for (int f = 0; f < kMaxFiledIDNum; ++f)
+		{
+			if (!s.field_events[f])
+				continue;
+			os << "field " << f << "\tcount:" << s.field_events[f]
+				<< "\tbytes:" << s.field_bytes[f] << std::endl;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LTraceScope
+LTraceScope::LTraceScope(const LClass* cls, LTraceEvent ev, size_t pos)
+	: m_counters(NULL), m_event(ev), m_begin_pos(pos), m_end_pos(pos), m_field_pos(pos)
+{
+	if (!LTrace::enabled())
+		return;
+	m_counters = LTrace::counters(cls->class_id());
+	m_begin = std::chrono::steady_clock::now();
+}
+
+LTraceScope::~LTraceScope()
+{
+	if (!m_counters)
+		return;
+	luint64 ns = (luint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - m_begin).count();
+	LTraceCounters::add(m_counters->events[m_event], 1);
+	LTraceCounters::add(m_counters->bytes[m_event], m_end_pos - m_begin_pos);
+	LTraceCounters::add(m_counters->nanos[m_event], ns);
+}
+
+}//lros
@@ -0,0 +1,132 @@
+#ifndef LROS_TRACE_H_
+#define LROS_TRACE_H_
+
+#include "ldefines.h"
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+//
+// LROS Trace
+//	- LROS_TRACE=0 (default): compiled out, the macros expand to nothing
+//	- LROS_TRACE=1: counters compiled in, recorded only while
+//	  LTrace::set_enabled(true), otherwise one relaxed load per object
+//	- counters are per thread, written only by the owning thread,
+//	  LTrace::snapshot() sums all threads without stopping them
+//
+#ifndef LROS_TRACE
+#define LROS_TRACE 0
+#endif
+
+namespace lros
+{
+
+class LStream;
+
+enum LTraceEvent
+{
+	kTrace_Construct,
+	kTrace_Serialize,
+	kTrace_SerializeDelta,
+	kTrace_Deserialize,
+	kTraceEventMax,
+};
+
+// snapshot of one class, summed over all threads
+struct LTraceClassStats
+{
+	int class_id;
+	const char* class_name;
+	luint64 events[kTraceEventMax];
+	luint64 bytes[kTraceEventMax];
+	luint64 nanos[kTraceEventMax];
+	luint64 field_events[kMaxFiledIDNum];	// field encodes + decodes
+	luint64 field_bytes[kMaxFiledIDNum];
+};
+
+// counters of one class in one thread
+struct LTraceCounters
+{
+	std::atomic<luint64> events[kTraceEventMax];
+	std::atomic<luint64> bytes[kTraceEventMax];
+	std::atomic<luint64> nanos[kTraceEventMax];
+	std::atomic<luint64> field_events[kMaxFiledIDNum];
+	std::atomic<luint64> field_bytes[kMaxFiledIDNum];
+
+	// single writer, so no RMW is needed
+	static inline void add(std::atomic<luint64>& c, luint64 v)
+	{
+		c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+	}
+};
+
+class LTrace
+{
+public:
+	static inline bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+	static void set_enabled(bool enabled);
+
+	// counters of class_id for the calling thread
+	static LTraceCounters* counters(int class_id);
+
+	// sum of all threads, classes without events are skipped
+	static void snapshot(std::vector<LTraceClassStats>& stats);
+	static void dump(std::ostream& os);
+
+private:
+	static std::atomic<bool> s_enabled;
+};
+
+//
+// LTraceScope - records one object event, and the fields written inside it
+//
+class LTraceScope
+{
+public:
+	LTraceScope(const LClass* cls, LTraceEvent ev, size_t pos);
+	~LTraceScope();
+
+	inline void field_begin(size_t pos)
+	{
+		m_field_pos = pos;
+	}
+	inline void field_end(int field_id, size_t pos)
+	{
+		if (!m_counters || (unsigned)field_id >= (unsigned)kMaxFiledIDNum)
+			return;
+		LTraceCounters::add(m_counters->field_events[field_id], 1);
+		LTraceCounters::add(m_counters->field_bytes[field_id], pos - m_field_pos);
+	}
+	inline void end(size_t pos)
+	{
+		m_end_pos = pos;
+	}
+
+private:
+	LTraceScope(const LTraceScope&);
+	LTraceScope& operator=(const LTraceScope&);
+
+	LTraceCounters* m_counters;
+	LTraceEvent m_event;
+	size_t m_begin_pos;
+	size_t m_end_pos;
+	size_t m_field_pos;
+	std::chrono::steady_clock::time_point m_begin;
+};
+
+}//lros
+
+#if LROS_TRACE
+#define LROS_TRACE_SCOPE(var, cls, ev, pos)			lros::LTraceScope var(cls, ev, pos)
+#define LROS_TRACE_FIELD_BEGIN(var, pos)			var.field_begin(pos)
+#define LROS_TRACE_FIELD_END(var, field_id, pos)	var.field_end(field_id, pos)
+#define LROS_TRACE_END(var, pos)					var.end(pos)
+#else
+#define LROS_TRACE_SCOPE(var, cls, ev, pos)			((void)0)
+#define LROS_TRACE_FIELD_BEGIN(var, pos)			((void)0)
+#define LROS_TRACE_FIELD_END(var, field_id, pos)	((void)0)
+#define LROS_TRACE_END(var, pos)					((void)0)
+#endif
+
+#endif //LROS_TRACE_H_
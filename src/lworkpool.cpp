@@ -0,0 +1,134 @@
+#include "lworkpool.h"
+
+namespace lros {
+
+LWorkPool::LWorkPool(size_t threads)
+	: m_job(NULL), m_generation(0), m_stop(false), m_remaining(0)
+{
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+
+	for (size_t i = 0; i < threads; ++i)
+		m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	for (size_t i = 1; i < threads; ++i)
+		m_threads.push_back(std::thread(&LWorkPool::worker_main, this, i));
+}
+
+LWorkPool::~LWorkPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto& t : m_threads)
+		t.join();
+}
+
+void LWorkPool::parallel_for(size_t count, size_t grain, const RangeFunc& fn)
+{
+	if (count == 0)
+		return;
+	if (grain == 0)
+		grain = 1;
+	const size_t workers = thread_count();
+	if (workers == 1 || count <= grain)
+	{
+		fn(0, count, 0);
+		return;
+	}
+
+	// every worker gets a contiguous share of the chunks
+	size_t chunks = (count + grain - 1) / grain;
+	m_job = &fn;
+	m_remaining.store(chunks, std::memory_order_relaxed);
+	for (size_t w = 0; w < workers; ++w)
+	{
+		size_t first = chunks * w / workers;
+		size_t last = chunks * (w + 1) / workers;
+		std::lock_guard<std::mutex> lock(m_queues[w]->mutex);
+		for (size_t c = first; c < last; ++c)
+		{
+			Range r = { c * grain, (c + 1) * grain < count ? (c + 1) * grain : count };
+			m_queues[w]->ranges.push_back(r);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_generation;
+	}
+	m_wake.notify_all();
+
+	while (run_one(0))
+	{
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_remaining.load(std::memory_order_acquire) == 0; });
+	m_job = NULL;
+}
+
+void LWorkPool::worker_main(size_t worker)
+{
+	size_t seen = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+			if (m_stop)
+				return;
+			seen = m_generation;
+		}
+		while (run_one(worker))
+		{
+		}
+	}
+}
+
+bool LWorkPool::run_one(size_t worker)
+{
+	Range r;
+	if (!pop(worker, false, r))
+	{
+		const size_t workers = thread_count();
+		bool found = false;
+		for (size_t i = 1; i < workers && !found; ++i)
+			found = pop((worker + i) % workers, true, r);
+		if (!found)
+			return false;
+	}
+
+	(*m_job)(r.begin, r.end, worker);
+
+	if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_done.notify_all();
+	}
+	return true;
+}
+
+bool LWorkPool::pop(size_t queue, bool steal, Range& r)
+{
+	Queue& q = *m_queues[queue];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.ranges.empty())
+		return false;
+	if (steal)
+	{
+		r = q.ranges.front();
+		q.ranges.pop_front();
+	}
+	else
+	{
+		r = q.ranges.back();
+		q.ranges.pop_back();
+	}
+	return true;
+}
+
+}//lros
@@ -0,0 +1,73 @@
+#ifndef LROS_WORKPOOL_H_
+#define LROS_WORKPOOL_H_
+
+#include "ldefines.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace lros
+{
+
+//
+// LWorkPool - work-stealing pool for data parallel loops
+//	- parallel_for() splits a range into chunks, each worker starts on its
+//	  own contiguous share and steals from the others when it runs dry
+//	- the calling thread works too, worker 0 is always the caller
+//	- one parallel_for at a time, not reentrant
+//
+class LWorkPool
+{
+public:
+	// fn(begin, end, worker), worker < thread_count()
+	typedef std::function<void(size_t, size_t, size_t)> RangeFunc;
+
+	// threads = 0 uses all hardware threads, 1 runs everything on the caller
+	explicit LWorkPool(size_t threads = 0);
+	~LWorkPool();
+
+	inline size_t thread_count() const { return m_queues.size(); }
+
+	// run fn over [0, count) in chunks of about grain, returns when all are done
+	void parallel_for(size_t count, size_t grain, const RangeFunc& fn);
+
+private:
+	LWorkPool(const LWorkPool&);
+	LWorkPool& operator=(const LWorkPool&);
+
+	struct Range
+	{
+		size_t begin;
+		size_t end;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Range> ranges;
+	};
+
+	void worker_main(size_t worker);
+	// run one chunk, own queue first (back), then steal (front)
+	bool run_one(size_t worker);
+	bool pop(size_t queue, bool steal, Range& r);
+
+	std::vector<std::unique_ptr<Queue> > m_queues;	// one per worker
+	std::vector<std::thread> m_threads;				// workers 1..n-1
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	const RangeFunc* m_job;
+	size_t m_generation;
+	bool m_stop;
+	std::atomic<size_t> m_remaining;
+};
+
+}//lros
+
+#endif //LROS_WORKPOOL_H_